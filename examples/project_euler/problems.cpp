@@ -185,8 +185,9 @@ uint64_t problem23() {
       return sum_divisors > n;
   };
 
-  let is_abundant = ftl::memoize<decltype(is_abundant_impl), int>(
-      is_abundant_impl);
+  auto is_abundant = ftl::dense_memoize<decltype(is_abundant_impl), int>(
+      is_abundant_impl, 1, max_num + 1);
+  is_abundant.prefill();
 
   let abundants = ftl::range(1, max_num + 1).filter(is_abundant).eval();
 
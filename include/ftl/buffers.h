@@ -0,0 +1,400 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <ftl/optional.h>
+
+namespace ftl {
+namespace impl {
+
+/* \brief Evaluates f on worker threads and hands back results in input order
+ *
+ *  Inputs are numbered as they are pushed and stored in a ring of window
+ *  slots. Workers pick up the oldest pending input, and the producer emits
+ *  finished slots from the head of the ring, so at most window elements are
+ *  in flight and results come out in the order they went in.
+ */
+template <typename In, typename Out, typename Func>
+class ordered_map_pool {
+public:
+  ordered_map_pool(const Func &f, size_t n_workers, size_t window)
+      : f_(f), in_(window), out_(window), err_(window), done_(window, false),
+        head_(0), tail_(0), next_(0), stop_(false) {
+    for (size_t idx = 0; idx < n_workers; ++idx) {
+      workers_.emplace_back([this]() { run(); });
+    }
+  }
+
+  ordered_map_pool(const ordered_map_pool&) = delete;
+  ordered_map_pool& operator=(const ordered_map_pool&) = delete;
+
+  ~ordered_map_pool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto &worker : workers_) {
+      worker.join();
+    }
+  }
+
+  /* \brief Queues x after emitting the finished results at the head of the
+   *  ring, waiting for the oldest one if the ring is full
+   *
+   *  Returns false once f_next has asked to stop.
+   */
+  template <typename T, typename FuncNext>
+  bool push(T &&x, const FuncNext &f_next) {
+    const size_t window = in_.size();
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (head_ < tail_ &&
+           (done_[head_ % window] || tail_ - head_ == window)) {
+      done_cv_.wait(lock, [this]() { return done_[head_ % in_.size()]; });
+      if (!emit(lock, f_next)) {
+        return false;
+      }
+      lock.lock();
+    }
+    in_[tail_ % window] = std::forward<T>(x);
+    ++tail_;
+    lock.unlock();
+    work_cv_.notify_one();
+    return true;
+  }
+
+  /* \brief Emits all remaining results in order
+   */
+  template <typename FuncNext>
+  void finish(const FuncNext &f_next) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (head_ < tail_) {
+      done_cv_.wait(lock, [this]() { return done_[head_ % in_.size()]; });
+      if (!emit(lock, f_next)) {
+        return;
+      }
+      lock.lock();
+    }
+  }
+
+private:
+  /* \brief Passes the result at the head of the ring to f_next
+   *
+   *  Must be called with the lock held on a finished head slot, and returns
+   *  with the lock released.
+   */
+  template <typename FuncNext>
+  bool emit(std::unique_lock<std::mutex> &lock, const FuncNext &f_next) {
+    const size_t slot = head_ % in_.size();
+    const auto err = err_[slot];
+    ftl::optional<Out> out;
+    std::swap(out, out_[slot]);
+    err_[slot] = nullptr;
+    done_[slot] = false;
+    ++head_;
+    if (err) {
+      stop_ = true;
+    }
+    lock.unlock();
+
+    if (err) {
+      work_cv_.notify_all();
+      std::rethrow_exception(err);
+    }
+    if (!f_next(*out)) {
+      lock.lock();
+      stop_ = true;
+      lock.unlock();
+      work_cv_.notify_all();
+      return false;
+    }
+    return true;
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      work_cv_.wait(lock, [this]() { return stop_ || next_ < tail_; });
+      if (stop_) {
+        return;
+      }
+      const size_t slot = next_++ % in_.size();
+      ftl::optional<In> x;
+      std::swap(x, in_[slot]);
+      lock.unlock();
+
+      ftl::optional<Out> res;
+      std::exception_ptr err;
+      try {
+        res = f_(*x);
+      } catch (...) {
+        err = std::current_exception();
+      }
+
+      lock.lock();
+      out_[slot] = std::move(res);
+      err_[slot] = err;
+      done_[slot] = true;
+      done_cv_.notify_one();
+    }
+  }
+
+  const Func f_;
+
+  std::vector<ftl::optional<In>> in_;
+  std::vector<ftl::optional<Out>> out_;
+  std::vector<std::exception_ptr> err_;
+  std::vector<bool> done_;
+
+  // Sequence numbers of the next result to emit, the next free slot and the
+  // next input for the workers: head_ <= next_ <= tail_
+  size_t head_;
+  size_t tail_;
+  size_t next_;
+  bool stop_;
+
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  std::vector<std::thread> workers_;
+};
+
+/* \brief Ring buffer for a single producer and a single consumer
+ *
+ *  The producer only writes tail_ and the consumer only writes head_, so the
+ *  two threads synchronize through a release store and an acquire load on
+ *  each side, without locking. A side that finds the ring full (push) or
+ *  empty (pop) yields for a few rounds and then sleeps on a condition
+ *  variable. Each side announces that it sleeps in a flag, and the other
+ *  side only takes the mutex to wake it when the flag is set.
+ */
+template <typename T>
+class spsc_queue {
+public:
+  static constexpr size_t spin_rounds = 64;
+
+  explicit spsc_queue(size_t capacity)
+      : mask_(ceil_pow2(std::max<size_t>(capacity, 2)) - 1),
+        slots_(new ftl::optional<T>[mask_ + 1]), head_(0), tail_(0),
+        closed_(false), cancelled_(false), producer_waits_(false),
+        consumer_waits_(false) { }
+
+  spsc_queue(const spsc_queue&) = delete;
+  spsc_queue& operator=(const spsc_queue&) = delete;
+
+  /* \brief Appends x, waiting for room; gives up and returns false once the
+   *  consumer has cancelled the queue
+   */
+  template <typename U>
+  bool push(U &&x) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    const auto has_room = [this, tail]() {
+        return tail - head_.load(std::memory_order_acquire) <= mask_ ||
+               cancelled_.load(std::memory_order_acquire);
+    };
+    if (!has_room()) {
+      wait(producer_waits_, has_room);
+    }
+    if (cancelled_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    slots_[tail & mask_] = std::forward<U>(x);
+    tail_.store(tail + 1, std::memory_order_release);
+    wake(consumer_waits_);
+    return !cancelled_.load(std::memory_order_relaxed);
+  }
+
+  /* \brief Moves the oldest element into x; returns false once the queue is
+   *  closed and empty
+   */
+  bool pop(ftl::optional<T> &x) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    const auto has_value = [this, head]() {
+        return tail_.load(std::memory_order_acquire) != head ||
+               closed_.load(std::memory_order_acquire);
+    };
+    if (!has_value()) {
+      wait(consumer_waits_, has_value);
+    }
+    if (tail_.load(std::memory_order_acquire) == head) {
+      return false;
+    }
+    x = std::move(slots_[head & mask_]);
+    slots_[head & mask_] = ftl::optional<T>();
+    head_.store(head + 1, std::memory_order_release);
+    wake(producer_waits_);
+    return true;
+  }
+
+  /* \brief Called by the producer after its last push
+   */
+  void close() {
+    closed_.store(true, std::memory_order_release);
+    wake(consumer_waits_);
+  }
+
+  /* \brief Called by the consumer to make pending and later pushes fail
+   */
+  void cancel() {
+    cancelled_.store(true, std::memory_order_release);
+    wake(producer_waits_);
+  }
+
+  /* \brief Whether push or pop is asleep on the condition variable, mainly
+   *  for tests
+   */
+  bool producer_sleeps() const {
+    return producer_waits_.load(std::memory_order_relaxed);
+  }
+
+  bool consumer_sleeps() const {
+    return consumer_waits_.load(std::memory_order_relaxed);
+  }
+
+private:
+  static size_t ceil_pow2(size_t x) {
+    size_t res = 1;
+    while (res < x) {
+      res *= 2;
+    }
+    return res;
+  }
+
+  template <typename Pred>
+  void wait(std::atomic<bool> &waits, const Pred &ready) {
+    for (size_t round = 0; round < spin_rounds; ++round) {
+      std::this_thread::yield();
+      if (ready()) {
+        return;
+      }
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    waits.store(true, std::memory_order_relaxed);
+    // Pairs with the fence in wake(): either this thread sees the update in
+    // ready(), or the other thread sees the flag and takes the mutex
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    cv_.wait(lock, ready);
+    waits.store(false, std::memory_order_relaxed);
+  }
+
+  void wake(std::atomic<bool> &waits) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waits.load(std::memory_order_relaxed)) {
+      { std::lock_guard<std::mutex> lock(mutex_); }
+      cv_.notify_all();
+    }
+  }
+
+  const size_t mask_;
+  std::unique_ptr<ftl::optional<T>[]> slots_;
+
+  alignas(64) std::atomic<size_t> head_;
+  alignas(64) std::atomic<size_t> tail_;
+  alignas(64) std::atomic<bool> closed_;
+  std::atomic<bool> cancelled_;
+  std::atomic<bool> producer_waits_;
+  std::atomic<bool> consumer_waits_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+};
+
+/* \brief Writes trivially copyable values to a file as packed binary
+ *  records, collecting single values in a large buffer
+ *
+ *  The records go to path + ".tmp", which close() renames to path once
+ *  everything is written. The target is left alone until then, so the
+ *  values may be read from the very file they are written back to. Errors
+ *  are reported as std::runtime_error, and a writer that is not closed
+ *  removes its temporary file.
+ */
+template <typename T>
+class record_writer {
+public:
+  static constexpr size_t buffer_bytes = 1 << 20;
+
+  explicit record_writer(const std::string &path)
+      : path_(path), tmp_path_(path + ".tmp"),
+        out_(tmp_path_, std::ios::binary | std::ios::trunc),
+        capacity_(std::max<size_t>(buffer_bytes / sizeof(T), 1)),
+        buffer_(new char[capacity_ * sizeof(T)]), size_(0), closed_(false) {
+    check();
+  }
+
+  ~record_writer() {
+    if (!closed_) {
+      out_.close();
+      std::remove(tmp_path_.c_str());
+    }
+  }
+
+  record_writer(const record_writer&) = delete;
+  record_writer& operator=(const record_writer&) = delete;
+
+  void push(const T &x) {
+    if (size_ == capacity_) {
+      flush();
+    }
+    std::memcpy(buffer_.get() + size_ * sizeof(T), &x, sizeof(T));
+    ++size_;
+  }
+
+  /* \brief Writes n values from memory, bypassing the buffer
+   */
+  void write(const T *data, size_t n) {
+    flush();
+    write_bytes(reinterpret_cast<const char*>(data), n * sizeof(T));
+  }
+
+  void close() {
+    flush();
+    out_.close();
+    check();
+    if (std::rename(tmp_path_.c_str(), path_.c_str()) != 0) {
+      throw std::runtime_error("ftl: could not write " + path_);
+    }
+    closed_ = true;
+  }
+
+private:
+  void flush() {
+    write_bytes(buffer_.get(), size_ * sizeof(T));
+    size_ = 0;
+  }
+
+  void write_bytes(const char *data, size_t size) {
+    if (size > 0) {
+      out_.write(data, static_cast<std::streamsize>(size));
+      check();
+    }
+  }
+
+  void check() const {
+    if (!out_) {
+      throw std::runtime_error("ftl: could not write " + path_);
+    }
+  }
+
+  const std::string path_;
+  const std::string tmp_path_;
+  std::ofstream out_;
+  const size_t capacity_;
+  std::unique_ptr<char[]> buffer_;
+  size_t size_;
+  bool closed_;
+};
+
+}  // namespace impl
+}  // namespace ftl
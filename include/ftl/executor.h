@@ -0,0 +1,294 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ftl {
+namespace impl {
+
+/* \brief Tracks a set of tasks spawned by a single parallel call
+ *
+ *  The count is only decremented while holding the mutex, so a thread that
+ *  sees the group finish in wait_for() knows that the last done() has
+ *  released it.
+ */
+class task_group {
+public:
+  task_group() : pending_(0) { }
+
+  void add() {
+    pending_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void done() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pending_.fetch_sub(1, std::memory_order_release) == 1) {
+      finished_cv_.notify_all();
+    }
+  }
+
+  bool finished() const {
+    return pending_.load(std::memory_order_acquire) == 0;
+  }
+
+  /* \brief Blocks until all tasks are done or the timeout has passed, and
+   *  returns whether they are done
+   */
+  template <typename Duration>
+  bool wait_for(const Duration &timeout) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return finished_cv_.wait_for(lock, timeout,
+                                 [this]() { return finished(); });
+  }
+
+  void set_exception(std::exception_ptr e) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!exception_) {
+      exception_ = e;
+    }
+  }
+
+  void rethrow() const {
+    if (exception_) {
+      std::rethrow_exception(exception_);
+    }
+  }
+
+private:
+  std::atomic<size_t> pending_;
+  std::mutex mutex_;
+  std::condition_variable finished_cv_;
+  std::exception_ptr exception_;
+};
+
+}  // namespace impl
+
+/* \brief Work-stealing thread pool
+ *
+ *  Every worker owns a deque of tasks. Workers push and pop at the back of
+ *  their own deque and steal from the front of the others, so large tasks
+ *  spawned early are the ones that get stolen. Threads waiting on a parallel
+ *  call run pending tasks until there are none left, which makes it safe to
+ *  start parallel calls from inside a task (e.g. nested sequences in
+ *  flat_map), and then sleep until the rest of their tasks are done.
+ */
+class executor {
+public:
+  explicit executor(size_t n_threads=std::thread::hardware_concurrency())
+      : queues_(std::max<size_t>(n_threads, 1)), queued_(0), next_(0),
+        sleeping_(0), stop_(false) {
+    for (auto &queue : queues_) {
+      queue.reset(new worker_queue());
+    }
+    for (size_t idx = 0; idx < queues_.size(); ++idx) {
+      threads_.emplace_back([this, idx]() { run(idx); });
+    }
+  }
+
+  executor(const executor&) = delete;
+  executor& operator=(const executor&) = delete;
+
+  ~executor() {
+    {
+      std::lock_guard<std::mutex> lock(idle_mutex_);
+      stop_ = true;
+    }
+    idle_cv_.notify_all();
+    for (auto &thread : threads_) {
+      thread.join();
+    }
+  }
+
+  /* \brief Shared executor with one worker per hardware thread
+   */
+  static executor& global() {
+    static executor exec;
+    return exec;
+  }
+
+  size_t size() const {
+    return threads_.size();
+  }
+
+  /* \brief Number of threads blocked on a task group in a parallel call,
+   *  mainly for tests
+   */
+  size_t sleeping() const {
+    return sleeping_.load(std::memory_order_relaxed);
+  }
+
+  /* \brief Calls f(begin, end) on sub-ranges of [begin, end) in parallel
+   *
+   *  The range is halved recursively until it is at most grain long. Returns
+   *  once all calls have finished and rethrows the first exception thrown.
+   */
+  template <typename Func>
+  void parallel_for(size_t begin, size_t end, size_t grain, const Func &f) {
+    impl::task_group group;
+    try {
+      split(group, begin, end, std::max<size_t>(grain, 1), f);
+    } catch (...) {
+      group.set_exception(std::current_exception());
+    }
+    wait(group);
+    group.rethrow();
+  }
+
+  /* \brief Runs all the given functions in parallel and waits for them
+   */
+  template <typename... Funcs>
+  void invoke(const Funcs&... fs) {
+    const std::function<void()> tasks[] = { fs... };
+    parallel_for(0, sizeof...(Funcs), 1, [&tasks](size_t begin, size_t end) {
+        for (size_t idx = begin; idx < end; ++idx) {
+          tasks[idx]();
+        }
+    });
+  }
+
+private:
+  static constexpr std::chrono::milliseconds wait_timeout{1};
+
+  struct worker_queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  template <typename Func>
+  void split(impl::task_group &group, size_t begin, size_t end, size_t grain,
+             const Func &f) {
+    while (end - begin > grain) {
+      const size_t mid = begin + (end - begin) / 2;
+      spawn(group, [this, &group, mid, end, grain, &f]() {
+          split(group, mid, end, grain, f);
+      });
+      end = mid;
+    }
+    if (begin < end) {
+      f(begin, end);
+    }
+  }
+
+  template <typename Func>
+  void spawn(impl::task_group &group, const Func &f) {
+    group.add();
+    push([&group, f]() {
+        try {
+          f();
+        } catch (...) {
+          group.set_exception(std::current_exception());
+        }
+        group.done();
+    });
+  }
+
+  void push(std::function<void()> task) {
+    const size_t idx = current() == this ?
+        current_index() : next_.fetch_add(1) % queues_.size();
+    {
+      std::lock_guard<std::mutex> lock(queues_[idx]->mutex);
+      queues_[idx]->tasks.push_back(std::move(task));
+    }
+    queued_.fetch_add(1);
+    {
+      std::lock_guard<std::mutex> lock(idle_mutex_);
+    }
+    idle_cv_.notify_one();
+  }
+
+  /* \brief Pops from the back of queue idx, or steals from another queue
+   */
+  bool try_pop(size_t idx, std::function<void()> &task) {
+    if (queued_.load() == 0) {
+      return false;
+    }
+    for (size_t i = 0; i < queues_.size(); ++i) {
+      auto &queue = *queues_[(idx + i) % queues_.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty()) {
+        if (i == 0) {
+          task = std::move(queue.tasks.back());
+          queue.tasks.pop_back();
+        } else {
+          task = std::move(queue.tasks.front());
+          queue.tasks.pop_front();
+        }
+        queued_.fetch_sub(1);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /* \brief Runs pending tasks while the group is busy, and blocks on the
+   *  group once there are none
+   *
+   *  done() wakes the thread as soon as the group finishes. It also looks
+   *  for work again every wait_timeout, because tasks queued in the meantime
+   *  may be left to it when all workers are waiting on groups themselves.
+   */
+  void wait(impl::task_group &group) {
+    const size_t idx = current() == this ? current_index() : 0;
+    std::function<void()> task;
+    while (true) {
+      while (!group.finished() && try_pop(idx, task)) {
+        task();
+      }
+      sleeping_.fetch_add(1, std::memory_order_relaxed);
+      const bool finished = group.wait_for(wait_timeout);
+      sleeping_.fetch_sub(1, std::memory_order_relaxed);
+      if (finished) {
+        return;
+      }
+    }
+  }
+
+  void run(size_t idx) {
+    current() = this;
+    current_index() = idx;
+    std::function<void()> task;
+    while (true) {
+      if (try_pop(idx, task)) {
+        task();
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(idle_mutex_);
+      idle_cv_.wait(lock, [this]() { return stop_ || queued_.load() > 0; });
+      if (stop_) {
+        return;
+      }
+    }
+  }
+
+  static executor*& current() {
+    static thread_local executor *exec = nullptr;
+    return exec;
+  }
+
+  static size_t& current_index() {
+    static thread_local size_t idx = 0;
+    return idx;
+  }
+
+  std::vector<std::unique_ptr<worker_queue>> queues_;
+  std::vector<std::thread> threads_;
+
+  std::atomic<size_t> queued_;
+  std::atomic<size_t> next_;
+  std::atomic<size_t> sleeping_;
+
+  std::mutex idle_mutex_;
+  std::condition_variable idle_cv_;
+  bool stop_;
+};
+
+}  // namespace ftl
@@ -1,9 +1,15 @@
 #pragma once
 
+#include <ftl/executor.h>
 #include <ftl/functors.h>
 #include <ftl/generators.h>
 #include <ftl/memoize.h>
 #include <ftl/seq.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <ftl/io.h>
+#include <ftl/persistent_memoize.h>
+#endif
+
 #define let const auto
 
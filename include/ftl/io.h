@@ -0,0 +1,434 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <ftl/mmap.h>
+#include <ftl/seq.h>
+#include <ftl/simd.h>
+
+namespace ftl {
+
+/* \brief Number of tokens read_numbers() converted, and number it skipped
+ *  because they were not valid numbers of the requested type
+ *
+ *  Counts are added once a pass over the input ends, so they accumulate if
+ *  the sequence is evaluated several times.
+ */
+struct parse_status {
+  size_t parsed = 0;
+  size_t malformed = 0;
+};
+
+namespace impl {
+
+inline const byte_set& newline() {
+  static const byte_set res("\n", 1);
+  return res;
+}
+
+inline const byte_set& whitespace() {
+  static const byte_set res(" \t\n\r\v\f", 6);
+  return res;
+}
+
+#if !defined(__cpp_lib_to_chars)
+template <typename T>
+bool parse_number(const char *first, const char *last, T &res,
+                  std::false_type) {
+  const auto parsed = std::from_chars(first, last, res);
+  return parsed.ec == std::errc() && parsed.ptr == last;
+}
+
+template <typename T>
+bool parse_number(const char *first, const char *last, T &res,
+                  std::true_type) {
+  const std::string token(first, last);
+  char *end = nullptr;
+  errno = 0;
+  res = static_cast<T>(std::strtold(token.c_str(), &end));
+  return errno == 0 && end == token.c_str() + token.size();
+}
+#endif
+
+/* \brief Parses all of [first, last) as a T, returning false if it is not a
+ *  valid number in range. A leading '+' is accepted.
+ */
+template <typename T>
+bool parse_number(const char *first, const char *last, T &res) {
+  if (last - first > 1 && *first == '+' && first[1] != '-') {
+    ++first;
+  }
+#if defined(__cpp_lib_to_chars)
+  const auto parsed = std::from_chars(first, last, res);
+  return parsed.ec == std::errc() && parsed.ptr == last;
+#else
+  return parse_number(first, last, res, std::is_floating_point<T>());
+#endif
+}
+
+/* \brief Parses the whitespace-separated tokens of a run of chars as T,
+ *  passing on valid numbers and counting the rest
+ */
+template <typename T>
+class number_parser {
+public:
+  explicit number_parser(parse_status *status) : status_(status) { }
+
+  number_parser(const number_parser&) = delete;
+  number_parser& operator=(const number_parser&) = delete;
+
+  ~number_parser() {
+    if (status_ != nullptr) {
+      status_->parsed += parsed_;
+      status_->malformed += malformed_;
+    }
+  }
+
+  /* \brief Passes on the tokens in [first, last) that are followed by
+   *  whitespace, where [first, scan) is known not to contain any. Returns
+   *  the start of the unfinished token at the end, or nullptr if f_next
+   *  stopped the sequence.
+   */
+  template <typename Func>
+  const char* complete_tokens(const char *first, const char *scan,
+                              const char *last, const Func &f_next) {
+    const char *begin = first;
+    const bool do_continue = for_each_of(scan, last, whitespace(),
+        [this, &f_next, &begin](const char *end) {
+            const bool res = begin == end || token(begin, end, f_next);
+            begin = end + 1;
+            return res;
+        });
+    return do_continue ? begin : nullptr;
+  }
+
+  template <typename Func>
+  bool token(const char *first, const char *last, const Func &f_next) {
+    T x;
+    if (parse_number(first, last, x)) {
+      ++parsed_;
+      return f_next(x);
+    }
+    ++malformed_;
+    return true;
+  }
+
+private:
+  parse_status *status_;
+  size_t parsed_ = 0;
+  size_t malformed_ = 0;
+};
+
+/* \brief Passes on the numbers in a run of chars, such as a mapped file
+ */
+template <typename T>
+class number_gen {
+public:
+  number_gen(const char *begin, const char *end, parse_status *status)
+      : begin_(begin), end_(end), status_(status) { }
+
+  template <typename Func>
+  void operator()(const Func &f_next) const {
+    number_parser<T> parser(status_);
+    const char *rest = parser.complete_tokens(begin_, begin_, end_, f_next);
+    if (rest != nullptr && rest != end_) {
+      parser.token(rest, end_, f_next);
+    }
+  }
+
+private:
+  const char *begin_;
+  const char *end_;
+  parse_status *status_;
+};
+
+/* \brief Passes on the numbers read from a stream, parsing them straight
+ *  from a large block buffer
+ *
+ *  A token cut off at the end of a block is moved to the front of the
+ *  buffer before the next read.
+ */
+template <typename T>
+class stream_number_gen {
+public:
+  stream_number_gen(std::istream &s, parse_status *status)
+      : s_(&s), status_(status) { }
+
+  template <typename Func>
+  void operator()(const Func &f_next) const {
+    number_parser<T> parser(status_);
+    size_t capacity = block_size;
+    std::unique_ptr<char[]> buffer(new char[capacity]);
+    size_t size = 0;
+    while (true) {
+      if (size == capacity) {
+        std::unique_ptr<char[]> larger(new char[2 * capacity]);
+        std::memcpy(larger.get(), buffer.get(), size);
+        buffer = std::move(larger);
+        capacity *= 2;
+      }
+      s_->read(buffer.get() + size,
+               static_cast<std::streamsize>(capacity - size));
+      const size_t num = static_cast<size_t>(s_->gcount());
+      if (num == 0) {
+        if (size > 0) {
+          parser.token(buffer.get(), buffer.get() + size, f_next);
+        }
+        return;
+      }
+
+      const char *end = buffer.get() + size + num;
+      const char *rest = parser.complete_tokens(buffer.get(),
+                                                buffer.get() + size, end,
+                                                f_next);
+      if (rest == nullptr) {
+        return;
+      }
+      size = static_cast<size_t>(end - rest);
+      std::memmove(buffer.get(), rest, size);
+    }
+  }
+
+private:
+  static constexpr size_t block_size = 1 << 20;
+
+  std::istream *s_;
+  parse_status *status_;
+};
+
+/* \brief Passes on the lines of a run of chars as std::string_view, without
+ *  their '\n'
+ *
+ *  Like std::getline, a last line without a trailing newline is passed on,
+ *  but a trailing newline does not produce an extra empty line.
+ *
+ *  The generator is splittable: size() counts bytes, and slice(begin, end)
+ *  moves both ends forward to the start of a line, so that neighbouring
+ *  slices cover every line exactly once.
+ */
+class line_gen {
+public:
+  line_gen(const char *begin, const char *end) : begin_(begin), end_(end) { }
+
+  template <typename Func>
+  void operator()(const Func &f_next) const {
+    const char *first = begin_;
+    const bool do_continue = for_each_of(begin_, end_, newline(),
+        [&f_next, &first](const char *last) {
+            const bool res = f_next(
+                std::string_view(first, static_cast<size_t>(last - first)));
+            first = last + 1;
+            return res;
+        });
+    if (do_continue && first != end_) {
+      f_next(std::string_view(first, static_cast<size_t>(end_ - first)));
+    }
+  }
+
+  size_t size() const {
+    return static_cast<size_t>(end_ - begin_);
+  }
+
+  line_gen slice(size_t begin, size_t end) const {
+    return line_gen(line_start(begin), line_start(end));
+  }
+
+private:
+  /* \brief Start of the first line that begins at or after pos
+   */
+  const char* line_start(size_t pos) const {
+    if (pos == 0) {
+      return begin_;
+    }
+    const char *it = find_any(begin_ + pos - 1, end_, newline());
+    return it == end_ ? end_ : it + 1;
+  }
+
+  const char *begin_;
+  const char *end_;
+};
+
+template <>
+struct is_splittable<line_gen> : std::true_type { };
+
+/* \brief Passes on the lines of a file descriptor as std::string_view,
+ *  reading it with read(2) in large blocks
+ *
+ *  Lines are located in each block with SIMD scanning and passed on as views
+ *  into the block. The unfinished line at the end of a block is moved to the
+ *  front of the buffer before the next read, and the buffer doubles if a
+ *  single line does not fit. Views are therefore only valid until the next
+ *  element.
+ */
+class fd_line_gen {
+public:
+  fd_line_gen(int fd, size_t buffer_size)
+      : fd_(fd), buffer_size_(std::max<size_t>(buffer_size, 1)) { }
+
+  template <typename Func>
+  void operator()(const Func &f_next) const {
+    size_t capacity = buffer_size_;
+    std::unique_ptr<char[]> buffer(new char[capacity]);
+    size_t size = 0;
+    while (true) {
+      if (size == capacity) {
+        std::unique_ptr<char[]> larger(new char[2 * capacity]);
+        std::memcpy(larger.get(), buffer.get(), size);
+        buffer = std::move(larger);
+        capacity *= 2;
+      }
+      const size_t num = read_some(buffer.get() + size, capacity - size);
+      if (num == 0) {
+        if (size > 0) {
+          f_next(std::string_view(buffer.get(), size));
+        }
+        return;
+      }
+
+      const char *first = buffer.get();
+      const bool do_continue = for_each_of(buffer.get() + size,
+          buffer.get() + size + num, newline(),
+          [&f_next, &first](const char *last) {
+              const bool res = f_next(
+                  std::string_view(first, static_cast<size_t>(last - first)));
+              first = last + 1;
+              return res;
+          });
+      if (!do_continue) {
+        return;
+      }
+      size = static_cast<size_t>(buffer.get() + size + num - first);
+      std::memmove(buffer.get(), first, size);
+    }
+  }
+
+private:
+  size_t read_some(char *data, size_t size) const {
+    while (true) {
+      const ssize_t num = ::read(fd_, data, size);
+      if (num >= 0) {
+        return static_cast<size_t>(num);
+      }
+      if (errno != EINTR) {
+        throw std::system_error(errno, std::generic_category(),
+                                "ftl: read");
+      }
+    }
+  }
+
+  int fd_;
+  size_t buffer_size_;
+};
+
+inline std::shared_ptr<const mapped_file> map_for_reading(
+    const std::string &path) {
+  auto file = std::make_shared<const mapped_file>(path);
+  file->advise(MADV_SEQUENTIAL);
+  return file;
+}
+
+}  // namespace impl
+
+/* \brief Sequence of the bytes of a file, read through a memory mapping
+ *
+ *  The mapping lives as long as the sequence or anything derived from it.
+ *  Since the bytes are contiguous, split_view() and the other char
+ *  specializations apply.
+ */
+inline auto mmap_bytes(const std::string &path) {
+  using gen_type = impl::seq_iter<const char*>;
+  const auto file = impl::map_for_reading(path);
+  return seq<gen_type, char, impl::mapped_file>(
+      gen_type(file->begin(), file->end()), file);
+}
+
+/* \brief Sequence of the lines of a file as std::string_view, read through a
+ *  memory mapping
+ *
+ *  The views point into the mapping, which lives as long as the sequence or
+ *  anything derived from it, including the results of eval() and
+ *  get_shared(). Copy a line into a std::string to keep it beyond that.
+ */
+inline auto mmap_lines(const std::string &path) {
+  const auto file = impl::map_for_reading(path);
+  return seq<impl::line_gen, std::string_view, impl::mapped_file>(
+      impl::line_gen(file->begin(), file->end()), file);
+}
+
+/* \brief Sequence of the lines read from a file descriptor, such as a pipe
+ *  or stdin, as std::string_view
+ *
+ *  The descriptor is read with read(2) into a buffer of buffer_size bytes
+ *  that is reused for the whole file, so a line is only valid until the
+ *  next one is passed on. Stages that look at one line at a time (map,
+ *  filter, count, ...) can use them directly; use owned() before anything
+ *  that keeps lines, such as get(), eval() or sorted(). The descriptor is
+ *  not closed.
+ */
+inline auto read_lines(int fd, size_t buffer_size=1 << 20) {
+  return seq<impl::fd_line_gen, std::string_view, impl::reused_buffer>(
+      impl::fd_line_gen(fd, buffer_size));
+}
+
+/* \brief Sequence of the whitespace-separated numbers in a file, parsed
+ *  with std::from_chars straight from a memory mapping
+ *
+ *  Tokens that are not valid numbers of type T (including out of range
+ *  values) are skipped rather than thrown on; pass a parse_status to count
+ *  them. The status must outlive every evaluation of the sequence.
+ */
+template <typename T>
+auto read_numbers(const std::string &path, parse_status *status=nullptr) {
+  const auto file = impl::map_for_reading(path);
+  return seq<impl::number_gen<T>, T, impl::mapped_file>(
+      impl::number_gen<T>(file->begin(), file->end(), status), file);
+}
+
+/* \brief Like read_numbers(path), but reads the stream in large blocks,
+ *  for input that cannot be mapped
+ */
+template <typename T>
+auto read_numbers(std::istream &s, parse_status *status=nullptr) {
+  return seq<impl::stream_number_gen<T>, T>(
+      impl::stream_number_gen<T>(s, status));
+}
+
+/* \brief Sequence of the packed binary records of type T in a file, such
+ *  as one written by seq::write_records(), read through a memory mapping
+ *
+ *  Elements are passed on as references into the mapping without being
+ *  copied, and since they are contiguous, the sequence supports par() and
+ *  the SIMD kernels for arithmetic T. The file must have been written on a
+ *  machine with the same layout for T. Throws std::runtime_error if its
+ *  size is not a multiple of sizeof(T).
+ */
+template <typename T>
+auto read_records(const std::string &path) {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "ftl: read_records requires a trivially copyable type");
+  using gen_type = impl::seq_iter<const T*>;
+  const auto file = impl::map_for_reading(path);
+  if (file->size() % sizeof(T) != 0) {
+    throw std::runtime_error("ftl: size of " + path +
+                             " is not a multiple of the record size");
+  }
+  const T *data = reinterpret_cast<const T*>(file->data());
+  return seq<gen_type, T, impl::mapped_file>(
+      gen_type(data, data + file->size() / sizeof(T)), file);
+}
+
+}  // namespace ftl
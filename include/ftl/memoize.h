@@ -1,52 +1,769 @@
 #pragma once
 
-#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <tuple>
 #include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <ftl/executor.h>
+#include <ftl/optional.h>
 
 namespace ftl {
 namespace impl {
 
-template <int N, typename... Args>
-struct tuple_hash : public std::unary_function<std::tuple< Args...>, size_t> {
+inline uint64_t hash_mix(uint64_t h) {
+  h *= 0x9e3779b97f4a7c15ull;
+  return h ^ (h >> 32);
+}
+
+inline uint64_t hash_combine(uint64_t seed, uint64_t h) {
+  return seed ^ (h + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+}
+
+/* \brief Order-sensitive hash of a list of std::hash-able values
+ */
+template <typename... Args>
+size_t hash_args(const Args&... args) {
+  uint64_t seed = 0;
+  const uint64_t hashes[] = { 0, std::hash<Args>()(args)... };
+  for (size_t idx = 1; idx < sizeof(hashes) / sizeof(hashes[0]); ++idx) {
+    seed = hash_combine(seed, hashes[idx]);
+  }
+  return static_cast<size_t>(hash_mix(seed));
+}
+
+template <typename... Args>
+struct tuple_hash {
   size_t operator()(const std::tuple<Args...>& key) const {
-    return std::get<N>(key) ^ tuple_hash<N - 1, Args...>(key);
+    return hash(key, std::index_sequence_for<Args...>());
+  }
+
+  template <size_t... Idx>
+  size_t hash(const std::tuple<Args...>& key,
+              std::index_sequence<Idx...>) const {
+    return hash_args(std::get<Idx>(key)...);
   }
 };
 
+template <typename... Args, size_t... Idx>
+bool tuple_equal(const std::tuple<Args...> &key, std::index_sequence<Idx...>,
+                 const Args&... args) {
+  const bool equal[] = { true, (std::get<Idx>(key) == args)... };
+  return std::all_of(std::begin(equal), std::end(equal),
+                     [](bool x) { return x; });
+}
+
+/* \brief Compares a key tuple against unpacked arguments
+ */
 template <typename... Args>
-struct tuple_hash<0, Args...>
-    : public std::unary_function<std::tuple< Args...>, size_t> {
-  size_t operator()(const std::tuple<Args...>& key) const {
-    return std::get<0>(key);
+bool tuple_equal(const std::tuple<Args...> &key, const Args&... args) {
+  return tuple_equal(key, std::index_sequence_for<Args...>(), args...);
+}
+
+/* \brief Insert-only open-addressing hash table
+ *
+ *  Follows the layout of Swiss tables: one control byte per slot holds
+ *  either "empty" or 7 bits of the hash, and slots are probed in groups of
+ *  16 whose control bytes are compared against the hash in a single SSE2
+ *  instruction. Slots point into a deque of entries, so entries never move
+ *  and references to them stay valid as the table grows.
+ */
+template <typename Key, typename Value>
+class flat_table {
+public:
+  struct entry {
+    entry(size_t hash, Key &&key, Value &&value)
+        : hash(hash), key(std::move(key)), value(std::move(value)) { }
+
+    const size_t hash;
+    const Key key;
+    const Value value;
+  };
+
+  flat_table()
+      : ctrl_(group_size, int8_t(empty)), slots_(group_size, nullptr) { }
+
+  /* \brief Copies the entries and points the new slots at the copies,
+   *  since the slots of other point into its own deque
+   */
+  flat_table(const flat_table &other)
+      : ctrl_(other.ctrl_.size(), int8_t(empty)),
+        slots_(other.slots_.size(), nullptr), entries_(other.entries_) {
+    for (const auto &e : entries_) {
+      place(&e);
+    }
+  }
+
+  // Moving a deque keeps its elements in place, so the slots stay valid
+  flat_table(flat_table&&) = default;
+
+  flat_table& operator=(const flat_table &other) {
+    flat_table copy(other);
+    return *this = std::move(copy);
+  }
+
+  flat_table& operator=(flat_table&&) = default;
+
+  size_t size() const {
+    return entries_.size();
+  }
+
+  /* \brief Approximate memory used by the table, not counting memory owned
+   *  by the keys and values themselves
+   */
+  size_t bytes() const {
+    return entries_.size() * sizeof(entry) +
+        ctrl_.size() * (sizeof(int8_t) + sizeof(const entry*));
+  }
+
+  /* \brief Returns the entry with the given hash for which eq(key) is true,
+   *  or nullptr
+   */
+  template <typename Eq>
+  const entry* find(size_t hash, const Eq &eq) const {
+    const size_t mask = ctrl_.size() / group_size - 1;
+    size_t group = (hash >> 7) & mask;
+    for (size_t step = 1; ; ++step) {
+      const int8_t *ctrl = &ctrl_[group * group_size];
+      for (uint32_t bits = match(ctrl, h2(hash)); bits != 0; bits &= bits - 1) {
+        const entry *e = slots_[group * group_size + lowest_bit(bits)];
+        if (e->hash == hash && eq(e->key)) {
+          return e;
+        }
+      }
+      if (match(ctrl, empty) != 0) {
+        return nullptr;
+      }
+      group = (group + step) & mask;
+    }
+  }
+
+  /* \brief Adds an entry for a key that is not in the table yet
+   */
+  const entry& insert(size_t hash, Key &&key, Value &&value) {
+    if ((entries_.size() + 1) * 8 > ctrl_.size() * 7) {
+      rehash(2 * ctrl_.size());
+    }
+    entries_.emplace_back(hash, std::move(key), std::move(value));
+    place(&entries_.back());
+    return entries_.back();
+  }
+
+private:
+  static constexpr size_t group_size = 16;
+  static constexpr int8_t empty = -128;
+
+  static int8_t h2(size_t hash) {
+    return static_cast<int8_t>(hash & 0x7f);
+  }
+
+  static size_t lowest_bit(uint32_t bits) {
+#if defined(__GNUC__)
+    return static_cast<size_t>(__builtin_ctz(bits));
+#else
+    size_t idx = 0;
+    while ((bits & 1) == 0) {
+      bits >>= 1;
+      ++idx;
+    }
+    return idx;
+#endif
+  }
+
+  /* \brief Bit i is set if ctrl[i] == x, for the 16 bytes of a group
+   */
+  static uint32_t match(const int8_t *ctrl, int8_t x) {
+#if defined(__SSE2__)
+    const __m128i group = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(ctrl));
+    return static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(x))));
+#else
+    uint32_t bits = 0;
+    for (size_t idx = 0; idx < group_size; ++idx) {
+      bits |= static_cast<uint32_t>(ctrl[idx] == x) << idx;
+    }
+    return bits;
+#endif
+  }
+
+  void place(const entry *e) {
+    const size_t mask = ctrl_.size() / group_size - 1;
+    size_t group = (e->hash >> 7) & mask;
+    for (size_t step = 1; ; ++step) {
+      const uint32_t bits = match(&ctrl_[group * group_size], empty);
+      if (bits != 0) {
+        const size_t idx = group * group_size + lowest_bit(bits);
+        ctrl_[idx] = h2(e->hash);
+        slots_[idx] = e;
+        return;
+      }
+      group = (group + step) & mask;
+    }
   }
+
+  void rehash(size_t size) {
+    ctrl_.assign(size, int8_t(empty));
+    slots_.assign(size, nullptr);
+    for (const auto &e : entries_) {
+      place(&e);
+    }
+  }
+
+  std::vector<int8_t> ctrl_;
+  std::vector<const entry*> slots_;
+  std::deque<entry> entries_;
 };
 
 }  // namespace impl
 
+/* \brief Counters returned by stats() on memoize_with_stats and
+ *  bounded_memoize_with_stats
+ *
+ *  Bytes is an estimate of the cache's own memory, not counting memory owned
+ *  by the keys and values.
+ */
+struct memoize_stats {
+  size_t hits = 0;
+  size_t misses = 0;
+  size_t insertions = 0;
+  size_t evictions = 0;
+  size_t entries = 0;
+  size_t bytes = 0;
+  std::chrono::nanoseconds compute_time = std::chrono::nanoseconds(0);
+};
+
+/* \brief Stats policy of memoize and bounded_memoize, whose hooks compile
+ *  away and which takes no space as an empty base
+ */
+struct no_stats {
+  void hit() const { }
+  void miss() const { }
+  void insertion() const { }
+  void eviction() const { }
+
+  template <typename Func, typename... Args>
+  auto call(const Func &f, const Args&... args) const
+      -> decltype(f(args...)) {
+    return f(args...);
+  }
+};
+
+/* \brief Stats policy that counts cache events and times calls to the
+ *  memoized function
+ */
+class collect_stats {
+public:
+  void hit() const { ++counters_.hits; }
+  void miss() const { ++counters_.misses; }
+  void insertion() const { ++counters_.insertions; }
+  void eviction() const { ++counters_.evictions; }
+
+  template <typename Func, typename... Args>
+  auto call(const Func &f, const Args&... args) const
+      -> decltype(f(args...)) {
+    const auto start = std::chrono::steady_clock::now();
+    auto res = f(args...);
+    counters_.compute_time +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start);
+    return res;
+  }
+
+  const memoize_stats& counters() const {
+    return counters_;
+  }
+
+private:
+  mutable memoize_stats counters_;
+};
+
+/* \brief Memoize with a stats policy; use it through memoize or
+ *  memoize_with_stats
+ */
+template <typename Stats, typename Func, typename... Args>
+class basic_memoize : private Stats {
+public:
+  using value_type = typename std::result_of<Func(Args...)>::type;
+
+  basic_memoize(const Func &f) : f_(f) { }
+
+  /* \brief Looks up the arguments directly, without copying them into a
+   *  key, and only builds the key when inserting a new value
+   */
+  const value_type& operator()(const Args&... args) const {
+    const size_t hash = impl::hash_args(args...);
+    const auto *e = cache_.find(hash, [&args...](const key_type &key) {
+        return impl::tuple_equal(key, args...);
+    });
+    if (e == nullptr) {
+      this->miss();
+      e = &cache_.insert(hash, key_type(args...), this->call(f_, args...));
+      this->insertion();
+    } else {
+      this->hit();
+    }
+    return e->value;
+  }
+
+  memoize_stats stats() const {
+    static_assert(std::is_same<Stats, collect_stats>::value,
+                  "ftl: stats() requires memoize_with_stats");
+    memoize_stats res = this->counters();
+    res.entries = cache_.size();
+    res.bytes = sizeof(*this) + cache_.bytes();
+    return res;
+  }
+
+private:
+  using key_type = std::tuple<Args...>;
+
+  mutable impl::flat_table<key_type, value_type> cache_;
+  Func f_;
+};
+
+template <typename Func, typename... Args>
+using memoize = basic_memoize<no_stats, Func, Args...>;
+
+/* \brief Memoize whose stats() reports hits, misses and the time spent in
+ *  the memoized function
+ */
 template <typename Func, typename... Args>
-class memoize {
+using memoize_with_stats = basic_memoize<collect_stats, Func, Args...>;
+
+/* \brief Memoize that can be shared between threads
+ *
+ *  Keys are spread over shards by hash. Each shard is a chained hash table
+ *  whose chains are only ever prepended to and whose entries are never
+ *  removed, so lookups walk them without taking a lock. A miss inserts a
+ *  pending entry under the shard lock and computes the value outside of it;
+ *  other threads missing on the same key wait for that value instead of
+ *  computing it again.
+ */
+template <typename Func, typename... Args>
+class concurrent_memoize {
 public:
   using value_type = typename std::result_of<Func(Args...)>::type;
 
-  memoize(const Func &f) : f_(f) { }
+  concurrent_memoize(const Func &f) : shards_(new shard[num_shards]), f_(f) { }
 
   const value_type& operator()(const Args&... args) const {
     const auto args_tup = std::tuple<Args...>(args...);
-    auto it = cache_.find(args_tup);
-    if (it == cache_.end()) {
-      it = cache_.emplace(args_tup, f_(args...)).first;
+    const size_t hash = hash_(args_tup);
+    auto &sh = shards_[hash % num_shards];
+
+    const entry *e = sh.find(args_tup, hash);
+    if (e != nullptr && e->state.load(std::memory_order_acquire) == ready) {
+      return *e->value;
+    }
+
+    std::unique_lock<std::mutex> lock(sh.mutex);
+    entry &ent = sh.find_or_insert(args_tup, hash);
+    while (true) {
+      const int state = ent.state.load(std::memory_order_relaxed);
+      if (state == ready) {
+        return *ent.value;
+      } else if (state == computing) {
+        sh.cv.wait(lock);
+      } else {
+        ent.state.store(computing, std::memory_order_relaxed);
+        lock.unlock();
+        try {
+          ent.value = f_(args...);
+        } catch (...) {
+          lock.lock();
+          ent.state.store(unclaimed, std::memory_order_relaxed);
+          lock.unlock();
+          sh.cv.notify_all();
+          throw;
+        }
+        lock.lock();
+        ent.state.store(ready, std::memory_order_release);
+        lock.unlock();
+        sh.cv.notify_all();
+        return *ent.value;
+      }
     }
-    return it->second;
   }
 
 private:
-  mutable std::unordered_map<
-      std::tuple<Args...>,
-      value_type,
-      impl::tuple_hash<sizeof...(Args) - 1, Args...>
-      > cache_;
+  using key_type = std::tuple<Args...>;
+
+  static constexpr size_t num_shards = 64;
+  static constexpr int unclaimed = 0;
+  static constexpr int computing = 1;
+  static constexpr int ready = 2;
+
+  struct entry {
+    entry(const key_type &key, size_t hash)
+        : key(key), hash(hash), state(unclaimed) { }
+
+    const key_type key;
+    const size_t hash;
+    std::atomic<int> state;
+    ftl::optional<value_type> value;
+  };
+
+  struct link {
+    const entry *ent;
+    const link *next;
+  };
+
+  struct table {
+    explicit table(size_t size)
+        : mask(size - 1), buckets(new std::atomic<const link*>[size]) {
+      for (size_t idx = 0; idx < size; ++idx) {
+        buckets[idx].store(nullptr, std::memory_order_relaxed);
+      }
+    }
+
+    const size_t mask;
+    std::unique_ptr<std::atomic<const link*>[]> buckets;
+  };
+
+  /* Tables and links are kept until destruction, since readers may still be
+   * walking a table that has been replaced by a larger one.
+   */
+  struct shard {
+    shard() : current(nullptr) {
+      tables.emplace_back(new table(16));
+      current.store(tables.back().get(), std::memory_order_release);
+    }
+
+    const entry* find(const key_type &key, size_t hash) const {
+      const table *t = current.load(std::memory_order_acquire);
+      const size_t idx = (hash / num_shards) & t->mask;
+      for (const link *l = t->buckets[idx].load(std::memory_order_acquire);
+           l != nullptr; l = l->next) {
+        if (l->ent->hash == hash && l->ent->key == key) {
+          return l->ent;
+        }
+      }
+      return nullptr;
+    }
+
+    // Must be called with the shard locked
+    entry& find_or_insert(const key_type &key, size_t hash) {
+      const entry *e = find(key, hash);
+      if (e != nullptr) {
+        return const_cast<entry&>(*e);
+      }
+      entries.emplace_back(key, hash);
+      if (entries.size() > current.load(std::memory_order_relaxed)->mask) {
+        grow();
+      }
+      insert(*current.load(std::memory_order_relaxed), entries.back());
+      return entries.back();
+    }
+
+    void grow() {
+      const table *old = current.load(std::memory_order_relaxed);
+      tables.emplace_back(new table(2 * (old->mask + 1)));
+      table &t = *tables.back();
+      for (size_t idx = 0; idx + 1 < entries.size(); ++idx) {
+        insert(t, entries[idx]);
+      }
+      current.store(&t, std::memory_order_release);
+    }
+
+    void insert(const table &t, const entry &e) {
+      auto &bucket = t.buckets[(e.hash / num_shards) & t.mask];
+      links.push_back(link{&e, bucket.load(std::memory_order_relaxed)});
+      bucket.store(&links.back(), std::memory_order_release);
+    }
+
+    std::atomic<const table*> current;
+    std::vector<std::unique_ptr<table>> tables;
+    std::deque<entry> entries;
+    std::deque<link> links;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+  };
+
+  impl::tuple_hash<Args...> hash_;
+  std::unique_ptr<shard[]> shards_;
   Func f_;
 };
 
-}  // namespace ftl
+/* \brief Memoize that keeps at most capacity entries
+ *
+ *  Entries live in a fixed array of slots swept by a CLOCK hand. A hit sets
+ *  the slot's reference bit; a miss on a full cache advances the hand,
+ *  clearing reference bits, and evicts the first slot whose bit is already
+ *  clear. Slots are found through a linear-probing index of slot numbers,
+ *  looked up with the arguments themselves, and both are allocated up
+ *  front, so hits never allocate. The returned reference is only valid
+ *  until the next call, which may evict it. Use it through bounded_memoize
+ *  or bounded_memoize_with_stats.
+ */
+template <typename Stats, typename Func, typename... Args>
+class basic_bounded_memoize : private Stats {
+public:
+  using value_type = typename std::result_of<Func(Args...)>::type;
+
+  basic_bounded_memoize(const Func &f, size_t capacity)
+      : slots_(std::max<size_t>(capacity, 1)),
+        index_(index_size(slots_.size()), npos), size_(0), hand_(0),
+        f_(f) { }
+
+  /* \brief Approximate number of entries that fit in the given number of
+   *  bytes, not counting memory owned by the keys and values themselves
+   */
+  static size_t capacity_for(size_t bytes) {
+    const size_t per_entry = sizeof(slot) + 2 * sizeof(size_t);
+    return std::max<size_t>(bytes / per_entry, 1);
+  }
+
+  const value_type& operator()(const Args&... args) const {
+    const size_t hash = impl::hash_args(args...);
+    const size_t mask = index_.size() - 1;
+    size_t pos = hash & mask;
+    for (; index_[pos] != npos; pos = (pos + 1) & mask) {
+      auto &s = slots_[index_[pos]];
+      if (s.hash == hash && impl::tuple_equal(*s.key, args...)) {
+        s.referenced = true;
+        this->hit();
+        return *s.value;
+      }
+    }
+
+    this->miss();
+    value_type value = this->call(f_, args...);
+    size_t idx = size_;
+    if (idx == slots_.size()) {
+      while (slots_[hand_].referenced) {
+        slots_[hand_].referenced = false;
+        hand_ = (hand_ + 1) % slots_.size();
+      }
+      idx = hand_;
+      hand_ = (hand_ + 1) % slots_.size();
+      unlink(idx);
+      this->eviction();
+
+      // Unlinking may have shifted entries into the free position
+      for (pos = hash & mask; index_[pos] != npos; pos = (pos + 1) & mask) { }
+    } else {
+      ++size_;
+    }
+    auto &s = slots_[idx];
+    s.key = key_type(args...);
+    s.value = std::move(value);
+    s.hash = hash;
+    s.referenced = false;
+    index_[pos] = idx;
+    this->insertion();
+    return *s.value;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  size_t capacity() const {
+    return slots_.size();
+  }
+
+  memoize_stats stats() const {
+    static_assert(std::is_same<Stats, collect_stats>::value,
+                  "ftl: stats() requires bounded_memoize_with_stats");
+    memoize_stats res = this->counters();
+    res.entries = size_;
+    res.bytes = sizeof(*this) + slots_.size() * sizeof(slot) +
+        index_.size() * sizeof(size_t);
+    return res;
+  }
+
+private:
+  using key_type = std::tuple<Args...>;
+
+  static constexpr size_t npos = ~size_t(0);
+
+  struct slot {
+    slot() : hash(0), referenced(false) { }
+
+    ftl::optional<key_type> key;
+    ftl::optional<value_type> value;
+    size_t hash;
+    bool referenced;
+  };
+
+  /* \brief Power of two with room for at least twice capacity entries
+   */
+  static size_t index_size(size_t capacity) {
+    size_t res = 2;
+    while (res < 2 * capacity) {
+      res *= 2;
+    }
+    return res;
+  }
 
+  /* \brief Removes slot idx from the index, shifting later entries of the
+   *  probe run back so that no lookup stops early
+   */
+  void unlink(size_t idx) const {
+    const size_t mask = index_.size() - 1;
+    size_t hole = slots_[idx].hash & mask;
+    while (index_[hole] != idx) {
+      hole = (hole + 1) & mask;
+    }
+    for (size_t pos = (hole + 1) & mask; index_[pos] != npos;
+         pos = (pos + 1) & mask) {
+      const size_t home = slots_[index_[pos]].hash & mask;
+      if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+        index_[hole] = index_[pos];
+        hole = pos;
+      }
+    }
+    index_[hole] = npos;
+  }
+
+  mutable std::vector<slot> slots_;
+  mutable std::vector<size_t> index_;
+  mutable size_t size_;
+  mutable size_t hand_;
+  Func f_;
+};
+
+template <typename Func, typename... Args>
+using bounded_memoize = basic_bounded_memoize<no_stats, Func, Args...>;
+
+/* \brief Bounded memoize whose stats() also reports evictions
+ */
+template <typename Func, typename... Args>
+using bounded_memoize_with_stats =
+    basic_bounded_memoize<collect_stats, Func, Args...>;
+
+/* \brief Memoize for a function of one integer over a bounded domain
+ *
+ *  Values for [lo, hi) are stored in a flat array next to a validity bitmap,
+ *  so a lookup is an indexed load instead of a hash table probe. Arguments
+ *  outside the domain throw std::out_of_range.
+ */
+template <typename Func, typename Arg>
+class dense_memoize {
+public:
+  using value_type = typename std::result_of<Func(Arg)>::type;
+
+  static_assert(std::is_integral<Arg>::value,
+                "dense_memoize requires an integral argument");
+  static_assert(std::is_default_constructible<value_type>::value,
+                "dense_memoize requires a default constructible value");
+
+  dense_memoize(const Func &f, Arg lo, Arg hi)
+      : lo_(lo), size_(hi > lo ? static_cast<size_t>(hi - lo) : 0),
+        values_(new value_type[size_]()), valid_((size_ + 63) / 64, 0),
+        f_(f) { }
+
+  dense_memoize(const dense_memoize &other)
+      : lo_(other.lo_), size_(other.size_), values_(new value_type[size_]),
+        valid_(other.valid_), f_(other.f_) {
+    std::copy(other.values_.get(), other.values_.get() + size_,
+              values_.get());
+  }
+
+  const value_type& operator()(const Arg &x) const {
+    const size_t idx = static_cast<size_t>(x) - static_cast<size_t>(lo_);
+    if (x < lo_ || idx >= size_) {
+      throw std::out_of_range("dense_memoize: argument out of range");
+    }
+    const uint64_t bit = uint64_t(1) << (idx % 64);
+    if ((valid_[idx / 64] & bit) == 0) {
+      values_[idx] = f_(x);
+      valid_[idx / 64] |= bit;
+    }
+    return values_[idx];
+  }
+
+  /* \brief Evaluates the whole domain in parallel on exec; f must be safe
+   *  to call from several threads
+   */
+  void prefill(executor &exec=executor::global()) {
+    exec.parallel_for(0, valid_.size(), 16, [this](size_t begin, size_t end) {
+        for (size_t word = begin; word < end; ++word) {
+          const size_t last = std::min(size_, 64 * (word + 1));
+          for (size_t idx = 64 * word; idx < last; ++idx) {
+            if ((valid_[word] & (uint64_t(1) << (idx % 64))) == 0) {
+              values_[idx] = f_(static_cast<Arg>(lo_ + idx));
+            }
+          }
+          valid_[word] = ~uint64_t(0);
+        }
+    });
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+private:
+  const Arg lo_;
+  const size_t size_;
+  std::unique_ptr<value_type[]> values_;
+  mutable std::vector<uint64_t> valid_;
+  Func f_;
+};
+
+/* \brief Memoize for recursive functions
+ *
+ *  f is called as f(self, args...), where self is the memoized function
+ *  itself, so every intermediate result of the recursion is cached. Since
+ *  the result type is deduced from f, f needs an explicit return type:
+ *
+ *    auto fib = ftl::make_memoize_rec<uint64_t>(
+ *        [](const auto &self, uint64_t n) -> uint64_t {
+ *            return n < 2 ? n : self(n - 1) + self(n - 2);
+ *        });
+ */
+template <typename Func, typename... Args>
+class memoize_rec {
+public:
+  using value_type =
+      typename std::result_of<Func(const memoize_rec&, Args...)>::type;
+
+  memoize_rec(const Func &f) : f_(f) { }
+
+  const value_type& operator()(const Args&... args) const {
+    const size_t hash = impl::hash_args(args...);
+    const auto eq = [&args...](const key_type &key) {
+        return impl::tuple_equal(key, args...);
+    };
+    const auto *e = cache_.find(hash, eq);
+    if (e == nullptr) {
+      auto value = f_(*this, args...);
+      // The recursion may have grown the table, so look the key up again
+      e = cache_.find(hash, eq);
+      if (e == nullptr) {
+        e = &cache_.insert(hash, key_type(args...), std::move(value));
+      }
+    }
+    return e->value;
+  }
+
+private:
+  using key_type = std::tuple<Args...>;
+
+  mutable impl::flat_table<key_type, value_type> cache_;
+  Func f_;
+};
+
+template <typename... Args, typename Func>
+auto make_memoize_rec(const Func &f) {
+  return memoize_rec<Func, Args...>(f);
+}
+
+}  // namespace ftl
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cerrno>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ftl {
+namespace impl {
+
+/* \brief Memory mapping of a whole file, unmapped on destruction
+ *
+ *  Read-only mappings are private; writable mappings are shared, so changes
+ *  end up in the file. Errors are reported as std::system_error.
+ */
+class mapped_file {
+public:
+  explicit mapped_file(const std::string &path, bool writable=false)
+      : path_(path), fd_(-1), data_(nullptr), size_(0), writable_(writable) {
+    fd_ = ::open(path.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd_ < 0) {
+      fail("open");
+    }
+    struct stat st;
+    if (::fstat(fd_, &st) != 0) {
+      const int err = errno;
+      ::close(fd_);
+      fail("stat", err);
+    }
+    try {
+      map(static_cast<size_t>(st.st_size));
+    } catch (...) {
+      ::close(fd_);
+      throw;
+    }
+  }
+
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+
+  ~mapped_file() {
+    unmap();
+    ::close(fd_);
+  }
+
+  const char* data() const {
+    return data_;
+  }
+
+  char* data() {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  const char* begin() const {
+    return data_;
+  }
+
+  const char* end() const {
+    return data_ + size_;
+  }
+
+  /* \brief Truncates or zero-extends a writable file and maps it again
+   *
+   *  If the file cannot be resized, it is mapped again at its old size
+   *  before the error is thrown.
+   */
+  void resize(size_t size) {
+    const size_t old_size = size_;
+    unmap();
+    if (::ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+      const int err = errno;
+      map(old_size);
+      fail("truncate", err);
+    }
+    map(size);
+  }
+
+  void flush() const {
+    if (size_ > 0 && ::msync(data_, size_, MS_SYNC) != 0) {
+      fail("msync");
+    }
+  }
+
+  void advise(int advice) const {
+    if (size_ > 0) {
+      ::madvise(data_, size_, advice);
+    }
+  }
+
+private:
+  void map(size_t size) {
+    size_ = size;
+    if (size_ == 0) {
+      return;
+    }
+    void *addr = ::mmap(nullptr, size_,
+        writable_ ? PROT_READ | PROT_WRITE : PROT_READ,
+        writable_ ? MAP_SHARED : MAP_PRIVATE, fd_, 0);
+    if (addr == MAP_FAILED) {
+      size_ = 0;
+      fail("mmap");
+    }
+    data_ = static_cast<char*>(addr);
+  }
+
+  void unmap() {
+    if (data_ != nullptr) {
+      ::munmap(data_, size_);
+      data_ = nullptr;
+    }
+    size_ = 0;
+  }
+
+  [[noreturn]] void fail(const char *what, int err=errno) const {
+    throw std::system_error(err, std::generic_category(),
+                            std::string("ftl: ") + what + " " + path_);
+  }
+
+  const std::string path_;
+  int fd_;
+  char *data_;
+  size_t size_;
+  const bool writable_;
+};
+
+}  // namespace impl
+}  // namespace ftl
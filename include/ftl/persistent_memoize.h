@@ -0,0 +1,265 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include <ftl/memoize.h>
+#include <ftl/mmap.h>
+
+namespace ftl {
+namespace impl {
+
+template <typename... Args>
+struct packed_size {
+  static constexpr size_t value = 0;
+};
+
+template <typename T, typename... Args>
+struct packed_size<T, Args...> {
+  static constexpr size_t value = sizeof(T) + packed_size<Args...>::value;
+};
+
+template <typename... Args>
+struct all_trivially_copyable : std::true_type { };
+
+template <typename T, typename... Args>
+struct all_trivially_copyable<T, Args...>
+    : std::integral_constant<bool, std::is_trivially_copyable<T>::value &&
+                                   all_trivially_copyable<Args...>::value> { };
+
+inline void pack_args(unsigned char*) { }
+
+/* \brief Copies the bytes of each argument one after the other into out
+ */
+template <typename T, typename... Args>
+void pack_args(unsigned char *out, const T &x, const Args&... args) {
+  std::memcpy(out, &x, sizeof(T));
+  pack_args(out + sizeof(T), args...);
+}
+
+/* \brief FNV-1a followed by hash_mix, stable across runs and platforms
+ */
+inline uint64_t hash_bytes(const unsigned char *data, size_t size) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t idx = 0; idx < size; ++idx) {
+    h = (h ^ data[idx]) * 0x100000001b3ull;
+  }
+  return hash_mix(h);
+}
+
+}  // namespace impl
+
+/* \brief Memoize backed by a memory-mapped file
+ *
+ *  The cache is a linear-probing hash table laid out directly in the file,
+ *  so reopening the same path on startup reuses every value computed by
+ *  earlier runs without parsing anything. Arguments and values must be
+ *  trivially copyable; arguments are compared byte for byte, so they should
+ *  not contain padding.
+ *
+ *  A file written by a persistent_memoize with another layout is started
+ *  over, while any other non-empty file is left alone and reported as
+ *  std::runtime_error. New tables, including the larger one the cache grows
+ *  into, are built in path + ".tmp" and renamed over path, so a crash leaves
+ *  the previous table intact. Copies share the same mapping, and values are
+ *  returned by copy since the table is remapped when it grows.
+ */
+template <typename Func, typename... Args>
+class persistent_memoize {
+public:
+  using value_type = typename std::result_of<Func(Args...)>::type;
+
+  static_assert(sizeof...(Args) > 0,
+                "persistent_memoize requires at least one argument");
+  static_assert(impl::all_trivially_copyable<value_type, Args...>::value,
+                "persistent_memoize requires trivially copyable types");
+
+  persistent_memoize(const Func &f, const std::string &path,
+                     size_t capacity=1024)
+      : store_(std::make_shared<storage>()), f_(f) {
+    store_->path = path;
+    store_->file.reset(new impl::mapped_file(path, true));
+    if (!valid()) {
+      if (file().size() > 0 && !has_magic()) {
+        throw std::runtime_error(
+            "ftl: " + path + " is not a persistent_memoize file");
+      }
+      size_t num_slots = 16;
+      while (num_slots * 3 < capacity * 4) {
+        num_slots *= 2;
+      }
+      rebuild(num_slots, false);
+    }
+  }
+
+  value_type operator()(const Args&... args) const {
+    unsigned char key[key_size];
+    impl::pack_args(key, args...);
+    const uint64_t hash = impl::hash_bytes(key, key_size);
+
+    const slot *s = find(key, hash);
+    if (s->full) {
+      return s->value;
+    }
+
+    const value_type value = f_(args...);
+    if ((header().count + 1) * 4 > header().capacity * 3) {
+      grow();
+    }
+    insert(key, hash, value);
+    return value;
+  }
+
+  /* \brief Writes all changes through to the file
+   */
+  void flush() const {
+    file().flush();
+  }
+
+  size_t size() const {
+    return header().count;
+  }
+
+private:
+  static constexpr size_t key_size = impl::packed_size<Args...>::value;
+  static constexpr uint64_t magic = 0x316f6d656d6c7466ull;  // "ftlmemo1"
+  static constexpr size_t header_size = 64;
+
+  struct header_type {
+    uint64_t magic;
+    uint64_t key_size;
+    uint64_t value_size;
+    uint64_t slot_size;
+    uint64_t capacity;
+    uint64_t count;
+  };
+
+  struct slot {
+    uint64_t hash;
+    uint64_t full;
+    value_type value;
+    unsigned char key[key_size];
+  };
+
+  static_assert(alignof(slot) <= header_size, "slot alignment too large");
+
+  /* \brief Mapping shared by all copies, replaced when the table is rebuilt
+   */
+  struct storage {
+    std::string path;
+    std::unique_ptr<impl::mapped_file> file;
+  };
+
+  impl::mapped_file& file() const {
+    return *store_->file;
+  }
+
+  header_type& header() const {
+    return *reinterpret_cast<header_type*>(file().data());
+  }
+
+  slot* slots() const {
+    return reinterpret_cast<slot*>(file().data() + header_size);
+  }
+
+  bool has_magic() const {
+    return file().size() >= header_size && header().magic == magic;
+  }
+
+  bool valid() const {
+    if (!has_magic()) {
+      return false;
+    }
+    const header_type &h = header();
+    return h.key_size == key_size &&
+        h.value_size == sizeof(value_type) && h.slot_size == sizeof(slot) &&
+        h.capacity > 0 && (h.capacity & (h.capacity - 1)) == 0 &&
+        h.count < h.capacity &&
+        file().size() == header_size + h.capacity * sizeof(slot);
+  }
+
+  /* \brief Lays out a table of num_slots slots in path + ".tmp", zero-filled
+   *  by the file system, optionally moves the current entries over, and
+   *  renames it over path
+   *
+   *  On failure the current table stays in place and the temporary file is
+   *  removed.
+   */
+  void rebuild(size_t num_slots, bool keep_entries) const {
+    const std::string tmp_path = store_->path + ".tmp";
+    std::unique_ptr<impl::mapped_file> old = std::move(store_->file);
+    try {
+      store_->file.reset(new impl::mapped_file(tmp_path, true));
+      file().resize(0);
+      file().resize(header_size + num_slots * sizeof(slot));
+      header_type &h = header();
+      h.magic = magic;
+      h.key_size = key_size;
+      h.value_size = sizeof(value_type);
+      h.slot_size = sizeof(slot);
+      h.capacity = num_slots;
+      h.count = 0;
+
+      if (keep_entries) {
+        const auto &old_header =
+            *reinterpret_cast<const header_type*>(old->data());
+        const auto *old_slots =
+            reinterpret_cast<const slot*>(old->data() + header_size);
+        for (size_t idx = 0; idx < old_header.capacity; ++idx) {
+          if (old_slots[idx].full) {
+            insert(old_slots[idx].key, old_slots[idx].hash,
+                   old_slots[idx].value);
+          }
+        }
+      }
+
+      file().flush();
+      if (std::rename(tmp_path.c_str(), store_->path.c_str()) != 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "ftl: rename " + tmp_path);
+      }
+      store_->file.reset(new impl::mapped_file(store_->path, true));
+    } catch (...) {
+      store_->file = std::move(old);
+      std::remove(tmp_path.c_str());
+      throw;
+    }
+  }
+
+  void grow() const {
+    rebuild(2 * header().capacity, true);
+  }
+
+  slot* find(const unsigned char *key, uint64_t hash) const {
+    const size_t mask = header().capacity - 1;
+    for (size_t idx = hash & mask; ; idx = (idx + 1) & mask) {
+      slot *s = &slots()[idx];
+      if (!s->full ||
+          (s->hash == hash && std::memcmp(s->key, key, key_size) == 0)) {
+        return s;
+      }
+    }
+  }
+
+  void insert(const unsigned char *key, uint64_t hash,
+              const value_type &value) const {
+    slot *s = find(key, hash);
+    s->hash = hash;
+    std::memcpy(s->key, key, key_size);
+    s->value = value;
+    s->full = 1;
+    ++header().count;
+  }
+
+  std::shared_ptr<storage> store_;
+  Func f_;
+};
+
+}  // namespace ftl
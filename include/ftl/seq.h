@@ -1,17 +1,118 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <iterator>
 #include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <utility>
 #include <vector>
 #include <set>
 
+#include <ftl/buffers.h>
+#include <ftl/executor.h>
 #include <ftl/functors.h>
 #include <ftl/optional.h>
+#include <ftl/simd.h>
 #include <ftl/utils.h>
 
 namespace ftl {
 namespace impl {
 
+/* \brief How many elements a generator is known to produce
+ */
+struct size_estimate {
+  enum kind_type { unknown, upper_bound, exact };
+
+  size_estimate(kind_type kind=unknown, size_t size=0)
+      : kind(kind), size(size) { }
+
+  kind_type kind;
+  size_t size;
+};
+
+/* \brief Size estimates of stages that produce an unknown number of
+ *  elements, exactly one element per input, and at most one per input
+ */
+struct unknown_size {
+  size_estimate operator()(const size_estimate&) const {
+    return size_estimate();
+  }
+};
+
+struct same_size {
+  size_estimate operator()(const size_estimate &prev) const {
+    return prev;
+  }
+};
+
+struct bounded_size {
+  size_estimate operator()(const size_estimate &prev) const {
+    return prev.kind == size_estimate::exact ?
+        size_estimate(size_estimate::upper_bound, prev.size) : prev;
+  }
+};
+
+template <typename Gen>
+auto get_size_hint(const Gen &gen, int) -> decltype(gen.size_hint()) {
+  return gen.size_hint();
+}
+
+template <typename Gen>
+size_estimate get_size_hint(const Gen&, long) {
+  return size_estimate();
+}
+
+/* \brief Size estimate of any generator, unknown unless it provides
+ *  size_hint()
+ */
+template <typename Gen>
+size_estimate get_size_hint(const Gen &gen) {
+  return get_size_hint(gen, 0);
+}
+
+/* \brief Most bytes reserved up front for an upper bound, past which the
+ *  vector grows as usual
+ */
+constexpr size_t max_bound_reserve_bytes = 1 << 20;
+
+/* \brief Reserves room for the estimated number of elements
+ *
+ *  Exact sizes are reserved in full. Upper bounds may be far from the
+ *  actual size, so only up to max_bound_reserve_bytes of them are reserved.
+ */
+template <typename T>
+void reserve(std::vector<T> &v, const size_estimate &hint) {
+  if (hint.kind == size_estimate::exact) {
+    v.reserve(v.size() + hint.size);
+  } else if (hint.kind == size_estimate::upper_bound) {
+    const size_t cap = std::max<size_t>(max_bound_reserve_bytes / sizeof(T), 1);
+    v.reserve(v.size() + std::min(hint.size, cap));
+  }
+}
+
+/* \brief Whether Iter walks over elements stored contiguously in memory
+ */
+template <typename Iter,
+          typename T=typename std::iterator_traits<Iter>::value_type>
+struct is_contiguous
+    : std::integral_constant<
+          bool,
+          std::is_pointer<Iter>::value ||
+          (!std::is_same<T, bool>::value &&
+           (std::is_same<Iter, typename std::vector<T>::iterator>::value ||
+            std::is_same<Iter,
+                         typename std::vector<T>::const_iterator>::value)) ||
+          std::is_same<Iter, std::string::iterator>::value ||
+          std::is_same<Iter, std::string::const_iterator>::value> { };
+
+/* \brief Number of elements handed out at a time by batched generators
+ */
+constexpr size_t batch_size = 256;
+
 template <typename Iter>
 class seq_iter {
 public:
@@ -26,13 +127,507 @@ public:
     }
   }
 
+  size_t size() const {
+    return static_cast<size_t>(std::distance(begin_, end_));
+  }
+
+  seq_iter slice(size_t begin, size_t end) const {
+    return seq_iter(begin_ + begin, begin_ + end);
+  }
+
+  const Iter& begin() const {
+    return begin_;
+  }
+
+  const Iter& end() const {
+    return end_;
+  }
+
+  /* \brief Calls f_batch(get, n) on consecutive runs of at most batch_size
+   *  elements, where get(i) returns the i-th element of the run
+   */
+  template <typename Func>
+  void apply_batch(const Func &f_batch) const {
+    const size_t num = size();
+    for (size_t first = 0; first < num; first += batch_size) {
+      const Iter it = begin_ + first;
+      const auto get = [&it](size_t idx) -> decltype(auto) {
+          return it[idx];
+      };
+      if (!f_batch(get, std::min(batch_size, num - first))) {
+        break;
+      }
+    }
+  }
+
+  size_estimate size_hint() const {
+    return size_hint(typename std::iterator_traits<Iter>::iterator_category());
+  }
+
+private:
+  size_estimate size_hint(std::random_access_iterator_tag) const {
+    return size_estimate(size_estimate::exact, size());
+  }
+
+  size_estimate size_hint(std::input_iterator_tag) const {
+    return size_estimate();
+  }
+
+  Iter begin_;
+  Iter end_;
+};
+
+template <typename Iter>
+struct is_contiguous_chars
+    : std::integral_constant<
+          bool,
+          is_contiguous<Iter>::value &&
+          std::is_same<typename std::iterator_traits<Iter>::value_type,
+                       char>::value> { };
+
+template <typename Gen>
+struct is_char_source : std::false_type { };
+
+template <typename Iter>
+struct is_char_source<seq_iter<Iter>> : is_contiguous_chars<Iter> { };
+
+/* \brief Whether Gen runs directly over values stored contiguously in memory
+ */
+template <typename Gen>
+struct is_contiguous_source : std::false_type { };
+
+template <typename Iter>
+struct is_contiguous_source<seq_iter<Iter>> : is_contiguous<Iter> { };
+
+/* \brief Whether Gen runs over arithmetic values stored contiguously in
+ *  memory, which the kernels in simd.h can process directly
+ */
+template <typename Gen>
+struct is_simd_source : std::false_type { };
+
+template <typename Iter>
+struct is_simd_source<seq_iter<Iter>>
+    : std::integral_constant<
+          bool,
+          is_contiguous<Iter>::value &&
+          is_simd_arithmetic<
+              typename std::iterator_traits<Iter>::value_type>::value> { };
+
+template <typename Iter>
+const typename std::iterator_traits<Iter>::value_type*
+data_of(const seq_iter<Iter> &gen) {
+  return gen.begin() != gen.end() ? std::addressof(*gen.begin()) : nullptr;
+}
+
+/* \brief Splits a contiguous run of chars on any of a set of separators,
+ *  passing each token on as a std::string_view into the original characters
+ *
+ *  Separators are located a block at a time with SIMD compares (see
+ *  for_each_of), rather than by testing one char per call.
+ */
+class split_view_gen {
+public:
+  split_view_gen(const char *begin, const char *end,
+                 const byte_set &separators)
+      : begin_(begin), end_(end), separators_(separators) { }
+
+  template <typename Func>
+  void operator()(const Func &f_next) const {
+    if (begin_ == end_) {
+      return;
+    }
+    const char *first = begin_;
+    const bool do_continue = for_each_of(begin_, end_, separators_,
+        [&f_next, &first](const char *last) {
+            const bool res = f_next(
+                std::string_view(first, static_cast<size_t>(last - first)));
+            first = last + 1;
+            return res;
+        });
+    if (do_continue) {
+      f_next(std::string_view(first, static_cast<size_t>(end_ - first)));
+    }
+  }
+
+private:
+  const char *begin_;
+  const char *end_;
+  byte_set separators_;
+};
+
+/* \brief Whether Gen is a source over random-access iterators, so that
+ *  positions and lengths can be computed with iterator arithmetic
+ */
+template <typename Gen>
+struct is_random_access_source : std::false_type { };
+
+template <typename Iter>
+struct is_random_access_source<seq_iter<Iter>>
+    : std::is_base_of<
+          std::random_access_iterator_tag,
+          typename std::iterator_traits<Iter>::iterator_category> { };
+
+/* \brief Passes on runs of num - 1 elements of a random-access range,
+ *  skipping every num-th one, without counting elements one at a time
+ */
+template <typename Iter>
+class drop_every_gen {
+public:
+  drop_every_gen(const Iter &begin, const Iter &end, size_t num)
+      : begin_(begin), end_(end), num_(num) { }
+
+  template <typename Func>
+  void operator()(const Func &f_next) const {
+    const size_t num = num_ > 0 ? num_ : size() + 1;
+    const size_t total = static_cast<size_t>(end_ - begin_);
+    for (size_t first = 0; first < total; first += num) {
+      const auto run = begin_ + first;
+      const size_t len = std::min(num - 1, total - first);
+      for (size_t idx = 0; idx < len; ++idx) {
+        if (!f_next(run[idx])) {
+          return;
+        }
+      }
+    }
+  }
+
+  size_t size() const {
+    const size_t total = static_cast<size_t>(end_ - begin_);
+    return num_ > 0 ? total - total / num_ : total;
+  }
+
+  size_estimate size_hint() const {
+    return size_estimate(size_estimate::exact, size());
+  }
+
 private:
   Iter begin_;
   Iter end_;
+  size_t num_;
+};
+
+/* \brief Value types that point into the data they were produced from,
+ *  including tuples, pairs and optionals that hold such a value
+ */
+template <typename T>
+struct is_view : std::false_type { };
+
+template <>
+struct is_view<std::string_view> : std::true_type { };
+
+template <typename... Ts>
+struct is_view<std::tuple<Ts...>>
+    : std::integral_constant<bool, (is_view<Ts>::value || ...)> { };
+
+template <typename T, typename U>
+struct is_view<std::pair<T, U>>
+    : std::integral_constant<bool, is_view<T>::value || is_view<U>::value> { };
+
+template <typename T>
+struct is_view<ftl::optional<T>> : is_view<T> { };
+
+/* \brief Type that holds its own copy of the data a view points into
+ */
+template <typename T>
+struct owned_type {
+  using type = T;
+};
+
+template <>
+struct owned_type<std::string_view> {
+  using type = std::string;
+};
+
+template <typename... Ts>
+struct owned_type<std::tuple<Ts...>> {
+  using type = std::tuple<typename owned_type<Ts>::type...>;
+};
+
+template <typename T, typename U>
+struct owned_type<std::pair<T, U>> {
+  using type = std::pair<typename owned_type<T>::type,
+                         typename owned_type<U>::type>;
+};
+
+/* \brief Data of sequences whose views point into a buffer that is reused
+ *  for later elements, so they are only valid until the next element
+ */
+struct reused_buffer { };
+
+template <typename Data, typename T>
+struct keeps_views
+    : std::integral_constant<bool, !std::is_same<Data, reused_buffer>::value ||
+                                   !is_view<T>::value> { };
+
+/* \brief Rejects stages that hold values of type T past the next element
+ *  when those values are views into a reused buffer
+ */
+template <typename Data, typename T>
+void check_keeps_views() {
+  static_assert(keeps_views<Data, T>::value,
+                "ftl: copy views into a reused buffer with owned() first");
+}
+
+template <typename T, typename Parent>
+std::shared_ptr<T> share(T &&x, const std::shared_ptr<Parent>&,
+                         std::false_type) {
+  return std::make_shared<T>(std::move(x));
+}
+
+/* \brief Moves x into a shared_ptr that also keeps parent alive
+ */
+template <typename T, typename Parent>
+std::shared_ptr<T> share(T &&x, const std::shared_ptr<Parent> &parent,
+                         std::true_type) {
+  const auto holder = std::make_shared<std::pair<std::shared_ptr<Parent>, T>>(
+      parent, std::move(x));
+  return std::shared_ptr<T>(holder, &holder->second);
+}
+
+/* \brief Number of elements taken from a among the first k elements of the
+ *  stable merge of a[0, n) and b[0, m)
+ *
+ *  Found by binary search, so a merge can be split into independent pieces
+ *  at any output positions.
+ */
+template <typename Iter, typename Func>
+size_t co_rank(size_t k, Iter a, size_t n, Iter b, size_t m,
+               const Func &cmp) {
+  size_t lo = k > m ? k - m : 0;
+  size_t hi = std::min(k, n);
+  while (lo < hi) {
+    const size_t i = lo + (hi - lo) / 2;
+    if (!cmp(b[k - i - 1], a[i])) {
+      lo = i + 1;
+    } else {
+      hi = i;
+    }
+  }
+  return lo;
+}
+
+/* \brief Stable merge of [a, a_end) and [b, b_end) into out, comparing the
+ *  values in place and only moving the one that goes out next
+ */
+template <typename Iter, typename Out, typename Func>
+void move_merge(Iter a, Iter a_end, Iter b, Iter b_end, Out out,
+                const Func &cmp) {
+  while (a != a_end && b != b_end) {
+    if (cmp(*b, *a)) {
+      *out++ = std::move(*b++);
+    } else {
+      *out++ = std::move(*a++);
+    }
+  }
+  out = std::move(a, a_end, out);
+  std::move(b, b_end, out);
+}
+
+template <typename Gen, typename Func>
+auto call_gen(const Gen &gen, const Func &f, int) -> decltype(gen(f), void()) {
+  gen(f);
+}
+
+template <typename Gen, typename Func>
+void call_gen(const Gen &gen, const Func &f, long) {
+  Gen copy(gen);
+  copy(f);
+}
+
+/* \brief Runs a generator in place, or on a copy if it can only be called
+ *  as non-const (e.g. a mutable lambda)
+ */
+template <typename Gen, typename Func>
+void call_gen(const Gen &gen, const Func &f) {
+  call_gen(gen, f, 0);
+}
+
+/* \brief Batch version of a stage, for stages that have none
+ */
+struct no_batch {
+  no_batch() { }
+
+  template <typename Func>
+  explicit no_batch(const Func&) { }
 };
 
+/* \brief Batch version of map: hands on an accessor that applies f to the
+ *  elements of the previous batch
+ */
+template <typename Func>
+struct map_batch {
+  template <typename Prev, typename FuncNext>
+  void operator()(const Prev &prev, const FuncNext &f_next) const {
+    prev.apply_batch([this, &f_next](const auto &in, size_t num) {
+        return f_next([this, &in](size_t idx) { return f(in(idx)); }, num);
+    });
+  }
+
+  Func f;
+};
+
+/* \brief Batch version of filter: builds a selection vector holding the
+ *  positions of the selected elements, without branching on f
+ *
+ *  Elements computed by earlier stages are copied into a buffer along the
+ *  way, so that they are not computed a second time.
+ */
+template <typename Func, typename T>
+struct filter_batch {
+  template <typename Prev, typename FuncNext>
+  void operator()(const Prev &prev, const FuncNext &f_next) const {
+    prev.apply_batch([this, &f_next](const auto &in, size_t num) {
+        return select(in, num, f_next,
+                      std::is_reference<decltype(in(0))>());
+    });
+  }
+
+  template <typename Get, typename FuncNext>
+  bool select(const Get &in, size_t num, const FuncNext &f_next,
+              std::true_type) const {
+    uint16_t sel[batch_size];
+    size_t selected = 0;
+    for (size_t idx = 0; idx < num; ++idx) {
+      sel[selected] = static_cast<uint16_t>(idx);
+      selected += f(in(idx)) ? 1 : 0;
+    }
+    return selected == 0 || f_next([&in, &sel](size_t idx) -> decltype(auto) {
+        return in(sel[idx]);
+    }, selected);
+  }
+
+  template <typename Get, typename FuncNext>
+  bool select(const Get &in, size_t num, const FuncNext &f_next,
+              std::false_type) const {
+    T out[batch_size];
+    size_t selected = 0;
+    for (size_t idx = 0; idx < num; ++idx) {
+      out[selected] = in(idx);
+      selected += f(out[selected]) ? 1 : 0;
+    }
+    return selected == 0 || f_next([&out](size_t idx) -> const T& {
+        return out[idx];
+    }, selected);
+  }
+
+  Func f;
+};
+
+/* \brief Generator that pipes the previous generator through a stage
+ *
+ *  A stage is splittable if it treats every element independently of the
+ *  others (map, filter, ...), in which case it can be re-applied to any slice
+ *  of the underlying source. Hint maps the size estimate of the previous
+ *  generator to the size estimate after the stage. Batch, unless it is
+ *  no_batch, is the same stage working on whole batches of elements (see
+ *  is_batched).
+ */
+template <typename Prev, typename Stage, bool Splittable,
+          typename Hint=unknown_size, typename Batch=no_batch>
+class pipe_gen {
+public:
+  pipe_gen(const Prev &prev, const Stage &stage, const Hint &hint=Hint(),
+           const Batch &batch=Batch())
+      : prev_(prev), stage_(stage), hint_(hint), batch_(batch) { }
+
+  template <typename Func>
+  void operator()(const Func &f_next) const {
+    stage_(prev_, f_next);
+  }
+
+  template <typename Func>
+  void apply_batch(const Func &f_batch) const {
+    batch_(prev_, f_batch);
+  }
+
+  size_t size() const {
+    return prev_.size();
+  }
+
+  auto slice(size_t begin, size_t end) const {
+    const auto prev = prev_.slice(begin, end);
+    return pipe_gen<decltype(prev), Stage, Splittable, Hint, Batch>(
+        prev, stage_, hint_, batch_);
+  }
+
+  size_estimate size_hint() const {
+    return hint_(get_size_hint(prev_));
+  }
+
+private:
+  Prev prev_;
+  Stage stage_;
+  Hint hint_;
+  Batch batch_;
+};
+
+/* \brief Whether a generator can be cut into independent slices
+ *
+ *  Sources opt in by specializing this trait and providing size() and
+ *  slice(begin, end).
+ */
+template <typename Gen>
+struct is_splittable : std::false_type { };
+
+template <typename Iter>
+struct is_splittable<seq_iter<Iter>>
+    : std::is_base_of<
+          std::random_access_iterator_tag,
+          typename std::iterator_traits<Iter>::iterator_category> { };
+
+template <typename Prev, typename Stage, typename Hint, typename Batch>
+struct is_splittable<pipe_gen<Prev, Stage, true, Hint, Batch>>
+    : is_splittable<Prev> { };
+
+/* \brief Whether a generator can hand out whole batches of elements
+ *
+ *  Batched generators provide apply_batch(f_batch), which calls
+ *  f_batch(get, n) on consecutive runs of n elements until it returns false,
+ *  where get(i) returns the i-th element of the run. Terminal operations
+ *  that look at every element (reduce, sum, count) then run a flat loop over
+ *  each run, which the compiler can unroll and vectorize, instead of one
+ *  chain of calls per element that can stop at any point.
+ */
+template <typename Gen>
+struct is_batched : std::false_type { };
+
+template <typename Iter>
+struct is_batched<seq_iter<Iter>>
+    : std::is_base_of<
+          std::random_access_iterator_tag,
+          typename std::iterator_traits<Iter>::iterator_category> { };
+
+template <typename Prev, typename Stage, bool Splittable, typename Hint,
+          typename Batch>
+struct is_batched<pipe_gen<Prev, Stage, Splittable, Hint, Batch>>
+    : std::integral_constant<bool, !std::is_same<Batch, no_batch>::value &&
+                                   is_batched<Prev>::value> { };
+
+template <typename Gen, typename Func>
+void for_each_batch(const Gen &gen, const Func &f_batch, std::true_type) {
+  gen.apply_batch(f_batch);
+}
+
+template <typename Gen, typename Func>
+void for_each_batch(const Gen &gen, const Func &f_batch, std::false_type) {
+  call_gen(gen, [&f_batch](const auto &x) {
+      return f_batch([&x](size_t) -> decltype(auto) { return x; }, 1);
+  });
+}
+
+/* \brief Calls f_batch(get, n) on batches of elements if gen is batched,
+ *  or on one element at a time otherwise
+ */
+template <typename Gen, typename Func>
+void for_each_batch(const Gen &gen, const Func &f_batch) {
+  for_each_batch(gen, f_batch, is_batched<Gen>());
+}
+
 }  // namespace impl
 
+template <typename Function, typename Value, typename Data>
+class par_seq;
+
 template <typename Function,
           typename Value,
           typename Data=std::vector<Value>>
@@ -49,34 +644,52 @@ public:
 
   /* \brief Apply a function to each element in the sequence
    *
-   *  The sequence stops when f(x) returns false.
+   *  The sequence stops when f(x) returns false. Values produced by a stage
+   *  (e.g. the result of map) are passed as rvalues and may be moved from;
+   *  elements of the underlying data are passed as const lvalues.
    */
   template <typename Func>
   void apply(const Func &f) const {
-    Function f_prev(f_);
-    f_prev([&f](const auto &x){ return f(x); });
+    impl::call_gen(f_, [&f](auto &&x){
+        return f(std::forward<decltype(x)>(x));
+    });
   }
 
   /* \brief Constructs lambda to pipe the result of one sequence into the next
    *
    *  The function f must take as arguments two lambdas, the first one
    *  containing the generator for the previous sequence and the second
-   *  containing the acceptor for the next sequence
+   *  containing the acceptor for the next sequence. Set Splittable if f
+   *  handles each element independently of the others, pass hint to tell how
+   *  f changes the number of elements, and batch to also run f on whole
+   *  batches (see impl::is_batched).
    */
-  template <typename Func>
-  auto pipe(const Func &f) const {
-    Function f_prev(f_);
-    return [f_prev, f](const auto &f_next){ f(f_prev, f_next); };
+  template <bool Splittable=false, typename Func,
+            typename Hint=impl::unknown_size, typename Batch=impl::no_batch>
+  auto pipe(const Func &f, const Hint &hint=Hint(),
+            const Batch &batch=Batch()) const {
+    return impl::pipe_gen<Function, Func, Splittable, Hint, Batch>(
+        f_, f, hint, batch);
   }
 
   auto get() const {
+    impl::check_keeps_views<Data, value_type>();
     std::vector<value_type> res;
-    apply([&res](const auto &x){ res.emplace_back(x); return true; });
+    impl::reserve(res, impl::get_size_hint(f_));
+    apply([&res](auto &&x){
+        res.emplace_back(std::forward<decltype(x)>(x));
+        return true;
+    });
     return res;
   }
 
+  /* \brief Materializes the sequence into a shared vector
+   *
+   *  If the elements are views (e.g. from split_view), the vector also keeps
+   *  the data they point into alive.
+   */
   auto get_shared() const {
-    return std::make_shared<std::vector<value_type>>(this->get());
+    return impl::share(this->get(), data_, impl::is_view<value_type>());
   }
 
   auto eval() const {
@@ -127,32 +740,87 @@ public:
     return any([](const T &x) { return static_cast<bool>(x); });
   }
 
+  /* \brief Runs everything upstream on a separate thread
+   *
+   *  Values are handed over through a ring buffer of the given capacity. The
+   *  upstream thread waits while the buffer is full, and stops as soon as the
+   *  rest of the sequence stops accepting values.
+   */
+  auto async_buffer(size_t capacity=1024) const {
+    impl::check_keeps_views<Data, value_type>();
+    auto lambda = pipe([capacity](const auto &f_prev, const auto &f_next) {
+        impl::spsc_queue<value_type> queue(capacity);
+        std::exception_ptr err;
+        std::thread producer([&f_prev, &queue, &err]() {
+            try {
+              f_prev([&queue](auto &&x) {
+                  return queue.push(std::forward<decltype(x)>(x));
+              });
+            } catch (...) {
+              err = std::current_exception();
+            }
+            queue.close();
+        });
+
+        {
+          struct join_guard {
+            ~join_guard() {
+              queue.cancel();
+              producer.join();
+            }
+            impl::spsc_queue<value_type> &queue;
+            std::thread &producer;
+          } guard{queue, producer};
+
+          ftl::optional<value_type> x;
+          while (queue.pop(x)) {
+            if (!f_next(*x)) {
+              break;
+            }
+          }
+        }
+
+        if (err) {
+          std::rethrow_exception(err);
+        }
+    });
+
+    return seq<decltype(lambda), value_type, Data>(lambda, data_);
+  }
+
   template <typename Func>
   size_t count(const Func &f) const {
-    size_t num = 0;;
-    apply([&num, &f](const auto &x){ if (f(x)) { num += 1; }; return true; });
+    size_t num = 0;
+    impl::for_each_batch(f_, [&num, &f](const auto &get, size_t n) {
+        for (size_t idx = 0; idx < n; ++idx) {
+          num += f(get(idx)) ? 1 : 0;
+        }
+        return true;
+    });
     return num;
   }
 
   size_t count() const {
-    return count([](const auto&){ return true; });
+    return count(typename impl::is_random_access_source<Function>::type());
   }
 
   template <typename Func>
   auto dedup(const Func &f) const {
+    impl::check_keeps_views<Data,
+                            decltype(f(impl::instance_of<value_type>()))>();
     auto lambda = pipe([f](const auto &f_prev, const auto &f_next) {
         optional<decltype(f(impl::instance_of<value_type>()))> last;
-        f_prev([&f_next, &f, &last](const auto &x){
+        f_prev([&f_next, &f, &last](auto &&x){
             const auto fx = f(x);
             if (!last || *last != fx) {
-              last = make_optional(fx);
-              return f_next(x);
+              last = ftl::make_optional(fx);
+              return f_next(std::forward<decltype(x)>(x));
             }
             return true;
         });
-    });
+    }, impl::bounded_size());
 
-    return seq<decltype(lambda), value_type>(lambda, data_);
+    return seq<decltype(lambda), value_type, Data>(lambda, data_);
   }
 
   auto dedup() const {
@@ -160,72 +828,53 @@ public:
   }
 
   auto drop(size_t num) const {
-    auto lambda = pipe([num](const auto &f_prev, const auto &f_next) {
-        size_t idx = 0;
-        f_prev([&f_next, num, &idx](const auto &x){
-            ++idx;
-            if (idx <= num) {
-              return true;
-            } else {
-              return f_next(x);
-            }
-        });
-    });
-
-    return seq<decltype(lambda), value_type, Data>(lambda, data_);
+    return drop(num, typename impl::is_random_access_source<Function>::type());
   }
 
   auto drop_every(size_t num) const {
-    auto lambda = pipe([num](const auto &f_prev, const auto &f_next) {
-        size_t idx = 0;
-        f_prev([&f_next, num, &idx](const auto &x){
-            idx++;
-            if (idx % num == 0) {
-              return true;
-            } else {
-              return f_next(x);
-            }
-        });
-    });
-
-    return seq<decltype(lambda), value_type, Data>(lambda, data_);
+    return drop_every(num,
+        typename impl::is_random_access_source<Function>::type());
   }
 
   template <typename Func>
   auto drop_while(const Func &f) const {
     auto lambda = pipe([f](const auto &f_prev, const auto &f_next) {
         bool do_drop = true;
-        f_prev([&f_next, &do_drop, &f](const auto &x){
+        f_prev([&f_next, &do_drop, &f](auto &&x){
             do_drop = do_drop && f(x);
             if (do_drop) {
               return true;
             } else {
-              return f_next(x);
+              return f_next(std::forward<decltype(x)>(x));
             }
         });
-    });
+    }, impl::bounded_size());
 
     return seq<decltype(lambda), value_type, Data>(lambda, data_);
   }
 
   template <typename Func>
   auto filter(const Func &f) const {
-    auto lambda = pipe([f](const auto &f_prev, const auto &f_next) {
-        f_prev([&f_next, &f](const auto &x){
+    using batch_type = typename std::conditional<
+        std::is_arithmetic<value_type>::value,
+        impl::filter_batch<typename std::decay<Func>::type, value_type>,
+        impl::no_batch>::type;
+    auto lambda = pipe<true>([f](const auto &f_prev, const auto &f_next) {
+        f_prev([&f_next, &f](auto &&x){
             if (f(x)) {
-              return f_next(x);
+              return f_next(std::forward<decltype(x)>(x));
             } else {
               return true;
             }
         });
-    });
+    }, impl::bounded_size(), batch_type{f});
 
     return seq<decltype(lambda), value_type, Data>(lambda, data_);
   }
 
   template <typename Func>
   auto flat_map(const Func &f) const {
-    auto lambda = pipe([f](const auto &f_prev, const auto &f_next) {
+    auto lambda = pipe<true>([f](const auto &f_prev, const auto &f_next) {
         f_prev([&f_next, &f](const auto &x){
             bool do_continue = true;
             x.apply([&f_next, &f, &do_continue](const auto &x) {
@@ -241,65 +890,160 @@ public:
   }
 
   ftl::optional<value_type> head() const {
+    impl::check_keeps_views<Data, value_type>();
     ftl::optional<value_type> h;
-    apply([&h](const auto &x){ h = ftl::make_optional(x); return false; });
+    apply([&h](auto &&x){
+        h = ftl::make_optional(std::forward<decltype(x)>(x));
+        return false;
+    });
     return h;
   }
 
+  /* \brief Sum using Kahan compensated summation, which keeps the rounding
+   *  error independent of the number of elements
+   */
+  template <typename T=value_type>
+  typename std::enable_if<std::is_floating_point<T>::value, T>::type
+  kahan_sum(const T &init=T()) const {
+    return kahan_sum(init, impl::is_simd_source<Function>());
+  }
+
   template <typename Func>
   auto map(const Func &f) const {
-    auto lambda = pipe([f](const auto &f_prev, const auto &f_next) {
-        f_prev([&f_next, &f](const auto &x){
+    using result_type = decltype(f(*(value_type*)(0)));
+    using batch_type = impl::map_batch<typename std::decay<Func>::type>;
+    auto lambda = pipe<true>([f](const auto &f_prev, const auto &f_next) {
+        f_prev([&f_next, &f](auto &&x){
             return f_next(f(x));
         });
-    });
+    }, impl::same_size(), batch_type{f});
 
-    return seq<decltype(lambda),
-               decltype(f(*(value_type*)(0))), Data>(lambda, data_);
+    return seq<decltype(lambda), result_type, Data>(lambda, data_);
   }
 
   template <typename Func>
   ftl::optional<value_type> max(const Func &cmp) const {
+    impl::check_keeps_views<Data, value_type>();
     ftl::optional<value_type> res;
-    apply([&res, &cmp](const auto &x){
+    apply([&res, &cmp](auto &&x){
       if (!res || cmp(*res, x)) {
-        res = ftl::optional<value_type>(x);
+        res = ftl::optional<value_type>(std::forward<decltype(x)>(x));
       }
       return true;
     });
     return res;
   }
 
+  /* \brief Largest element, using SIMD compares on contiguous arithmetic
+   *  sources
+   */
   template <typename T=value_type>
   typename std::enable_if<impl::lt_exists<T>::value, ftl::optional<T>>::type
   max() const {
-    return max([](const T &x, const T &y) { return x < y; });
+    return max(typename impl::is_simd_source<Function>::type());
   }
 
-  template <typename T, typename Func>
-  T reduce(T init, const Func &f) const {
-    apply([&init, &f](const auto &x){ init = f(init, x); return true; });
-
-    return init;
+  /* \brief Copies view values (e.g. std::string_view lines from read_lines)
+   *  into values that own their data, so later stages can keep them
+   */
+  auto owned() const {
+    using result_type = typename impl::owned_type<value_type>::type;
+    return map([](const value_type &x) { return result_type(x); });
   }
 
+  /* \brief Like map, but evaluates f on n_workers threads
+   *
+   *  Results are passed on in the original order. At most window elements
+   *  (4 * n_workers by default) are in flight at any time, and the workers
+   *  stop as soon as the rest of the sequence stops accepting values.
+   */
   template <typename Func>
-  auto reject(const Func &f) const {
-    return filter([f](const auto &x){ return !f(x); });
-  }
+  auto par_map(const Func &f,
+               size_t n_workers=std::thread::hardware_concurrency(),
+               size_t window=0) const {
+    impl::check_keeps_views<Data, value_type>();
+    using result_type = decltype(f(impl::instance_of<value_type>()));
+    n_workers = std::max<size_t>(n_workers, 1);
+    window = window > 0 ? window : 4 * n_workers;
+    auto lambda = pipe([f, n_workers, window](const auto &f_prev,
+                                              const auto &f_next) {
+        impl::ordered_map_pool<value_type, result_type, Func> pool(
+            f, n_workers, window);
+        bool do_continue = true;
+        f_prev([&f_next, &pool, &do_continue](auto &&x) {
+            do_continue = pool.push(std::forward<decltype(x)>(x), f_next);
+            return do_continue;
+        });
 
-  auto reverse() const {
-    auto res = get_shared();
-    std::reverse(res->begin(), res->end());
+        if (do_continue) {
+          pool.finish(f_next);
+        }
+    });
 
-    return seq<seq_iter_type, value_type>(
-        seq_iter_type(res->begin(), res->end()), res);
+    return seq<decltype(lambda), result_type, Data>(lambda, data_);
   }
 
-  template <typename Func>
-  auto scan(const Func &f) const {
+  /* \brief Run the terminal operations in parallel on exec
+   *
+   *  Falls back to the calling thread if the sequence cannot be split.
+   */
+  auto par(executor &exec=executor::global()) const {
+    return par_seq<Function, Value, Data>(*this, exec, exec.size());
+  }
+
+  /* \brief Run the terminal operations in parallel, with work split for
+   *  n_threads threads of the global executor
+   */
+  auto par(size_t n_threads) const {
+    return par_seq<Function, Value, Data>(*this, executor::global(),
+                                          n_threads);
+  }
+
+  template <typename T, typename Func>
+  T reduce(T init, const Func &f) const {
+    impl::for_each_batch(f_, [&init, &f](const auto &get, size_t n) {
+        for (size_t idx = 0; idx < n; ++idx) {
+          init = f(init, get(idx));
+        }
+        return true;
+    });
+
+    return init;
+  }
+
+  /* \brief Reducing with std::plus over contiguous arithmetic data runs the
+   *  same kernels as sum()
+   *
+   *  That is only the same fold when each element is converted to T before
+   *  it is added: std::plus<T> does so, while std::plus<> adds in the common
+   *  type and so only qualifies when T is the value type.
+   */
+  template <typename T, typename U>
+  T reduce(T init, const std::plus<U> &f) const {
+    return reduce(init, f, std::integral_constant<
+        bool,
+        (std::is_void<U>::value ? std::is_same<T, value_type>::value
+                                : std::is_same<U, T>::value) &&
+        use_sum_kernel<T>::value>());
+  }
+
+  template <typename Func>
+  auto reject(const Func &f) const {
+    return filter([f](const auto &x){ return !f(x); });
+  }
+
+  /* \brief The elements in reverse order. Random-access sources are walked
+   *  backwards in place, anything else is materialized first.
+   */
+  auto reverse() const {
+    return reverse(typename impl::is_random_access_source<Function>::type());
+  }
+
+  template <typename Func>
+  auto scan(const Func &f) const {
     using result_type = decltype(f(impl::instance_of<value_type>(),
                                    impl::instance_of<value_type>()));
+    impl::check_keeps_views<Data, result_type>();
     auto lambda = pipe([f](const auto &f_prev, const auto &f_next) {
         optional<result_type> acc;
         f_prev([&f_next, &f, &acc](const auto &x){
@@ -310,23 +1054,24 @@ public:
             }
             return f_next(*acc);
         });
-    });
+    }, impl::same_size());
 
-    return seq<decltype(lambda), result_type>(lambda, data_);
+    return seq<decltype(lambda), result_type, Data>(lambda, data_);
   }
 
   template <typename T, typename Func>
   auto scan(const T &init, const Func &f) const {
     using result_type = decltype(f(init, impl::instance_of<value_type>()));
+    impl::check_keeps_views<Data, result_type>();
     auto lambda = pipe([init, f](const auto &f_prev, const auto &f_next) {
         result_type acc = init;
         f_prev([&f_next, &f, &acc](const auto &x){
             acc = f(x, acc);
             return f_next(acc);
         });
-    });
+    }, impl::same_size());
 
-    return seq<decltype(lambda), result_type>(lambda, data_);
+    return seq<decltype(lambda), result_type, Data>(lambda, data_);
   }
 
 
@@ -348,119 +1093,773 @@ public:
   }
 
   /* Note: Result must conform to a standard container interface
+   *
+   *  On a contiguous source of chars, separators are found with SIMD
+   *  scanning and each token is copied into Result in one go.
    */
   template <typename Result=std::vector<value_type>>
   auto split(const value_type &separator) const {
+    return split<Result>(separator, impl::is_char_source<Function>());
+  }
+
+  /* \brief Like split, but passes on std::string_view tokens that point into
+   *  the underlying characters instead of copying them
+   *
+   *  Only available directly on a contiguous source of chars. The tokens are
+   *  valid as long as the characters are; eval() and get_shared() keep the
+   *  sequence's own data alive.
+   */
+  template <typename F=Function>
+  typename std::enable_if<
+      impl::is_char_source<F>::value,
+      seq<impl::split_view_gen, std::string_view, Data>>::type
+  split_view(char separator) const {
+    return split_view(impl::byte_set(&separator, 1));
+  }
+
+  /* \brief Splits on any of up to 8 separators, e.g. " \t\n"
+   */
+  template <typename F=Function>
+  typename std::enable_if<
+      impl::is_char_source<F>::value,
+      seq<impl::split_view_gen, std::string_view, Data>>::type
+  split_view(std::string_view separators) const {
+    return split_view(
+        impl::byte_set(separators.data(), separators.size()));
+  }
+
+  /* \brief Sum of the elements, plus init
+   *
+   *  Contiguous arithmetic sources are added up with SIMD in several
+   *  independent lanes. For floating point this is not bit-identical to a
+   *  left fold; use kahan_sum() when the rounding error matters.
+   */
+  template <typename T=value_type>
+  typename std::enable_if<impl::plus_exists<T>::value, T>::type
+  sum(const T& init=T()) const {
+    return sum(init, use_sum_kernel<T>());
+  }
+
+  ftl::optional<value_type> tail() const {
+    impl::check_keeps_views<Data, value_type>();
+    return tail(typename impl::is_random_access_source<Function>::type());
+  }
+
+  auto take(const size_t num) {
+    return take(num, typename impl::is_random_access_source<Function>::type());
+  }
+
+  template <typename Func>
+  auto take_while(const Func &f) const {
+    auto lambda = pipe([f](const auto &f_prev, const auto &f_next) {
+        f_prev([&f_next, &f](auto &&x){
+            if (f(x)) {
+              return f_next(std::forward<decltype(x)>(x));
+            } else {
+              return false;
+            }
+        });
+    }, impl::bounded_size());
+
+    return seq<decltype(lambda), value_type, Data>(lambda, data_);
+  }
+
+  template <typename Func>
+  auto uniq(const Func &f) const {
+    impl::check_keeps_views<Data,
+                            decltype(f(impl::instance_of<value_type>()))>();
+    auto lambda = pipe([f](const auto &f_prev, const auto &f_next) {
+        std::set<decltype(f(impl::instance_of<value_type>()))> vals;
+        f_prev([&f_next, &f, &vals](auto &&x){
+            const auto fx = f(x);
+            const auto it = vals.find(fx);
+            if (it == vals.end()) {
+              vals.insert(fx);
+              return f_next(std::forward<decltype(x)>(x));
+            }
+            return true;
+        });
+    }, impl::bounded_size());
+
+    return seq<decltype(lambda), value_type, Data>(lambda, data_);
+  }
+
+  auto uniq() const {
+    return uniq(identity());
+  }
+
+  auto with_index() const {
+    auto lambda = pipe([](const auto &f_prev, const auto &f_next) {
+        size_t idx = 0;
+        f_prev([&f_next, &idx](auto &&x) {
+            return f_next(
+                std::make_tuple(idx++, std::forward<decltype(x)>(x)));
+        });
+    }, impl::same_size());
+
+    return seq<decltype(lambda), std::tuple<size_t, value_type>, Data>(lambda,
+        data_);
+  }
+
+  /* \brief Writes the elements to path as packed binary records, which
+   *  read_records<value_type>(path) maps back in
+   *
+   *  A contiguous source, such as the result of eval(), is written straight
+   *  from memory; anything else goes through a large buffer. path is only
+   *  replaced once all records are written, so it may be the file the
+   *  sequence reads from.
+   */
+  void write_records(const std::string &path) const {
+    static_assert(std::is_trivially_copyable<value_type>::value,
+                  "ftl: write_records requires trivially copyable values");
+    impl::record_writer<value_type> out(path);
+    write_records(out, typename impl::is_contiguous_source<Function>::type());
+    out.close();
+  }
+
+private:
+  template <typename, typename, typename>
+  friend class par_seq;
+
+  template <typename T>
+  using use_sum_kernel = std::integral_constant<
+      bool,
+      impl::is_simd_source<Function>::value &&
+      impl::is_simd_arithmetic<T>::value>;
+
+  size_t count(std::true_type) const {
+    return f_.size();
+  }
+
+  size_t count(std::false_type) const {
+    size_t num = 0;
+    impl::for_each_batch(f_, [&num](const auto&, size_t n) {
+        num += n;
+        return true;
+    });
+    return num;
+  }
+
+  auto drop(size_t num, std::true_type) const {
+    const size_t size = f_.size();
+    return seq<Function, value_type, Data>(
+        f_.slice(std::min(num, size), size), data_);
+  }
+
+  auto drop(size_t num, std::false_type) const {
+    auto lambda = pipe([num](const auto &f_prev, const auto &f_next) {
+        size_t idx = 0;
+        f_prev([&f_next, num, &idx](auto &&x){
+            ++idx;
+            if (idx <= num) {
+              return true;
+            } else {
+              return f_next(std::forward<decltype(x)>(x));
+            }
+        });
+    }, [num](impl::size_estimate hint) {
+        hint.size = hint.size > num ? hint.size - num : 0;
+        return hint;
+    });
+
+    return seq<decltype(lambda), value_type, Data>(lambda, data_);
+  }
+
+  auto drop_every(size_t num, std::true_type) const {
+    using iterator = typename std::decay<decltype(f_.begin())>::type;
+    return seq<impl::drop_every_gen<iterator>, value_type, Data>(
+        impl::drop_every_gen<iterator>(f_.begin(), f_.end(), num), data_);
+  }
+
+  auto drop_every(size_t num, std::false_type) const {
+    auto lambda = pipe([num](const auto &f_prev, const auto &f_next) {
+        size_t idx = 0;
+        f_prev([&f_next, num, &idx](auto &&x){
+            idx++;
+            if (idx % num == 0) {
+              return true;
+            } else {
+              return f_next(std::forward<decltype(x)>(x));
+            }
+        });
+    }, impl::bounded_size());
+
+    return seq<decltype(lambda), value_type, Data>(lambda, data_);
+  }
+
+  template <typename T>
+  T kahan_sum(const T &init, std::true_type) const {
+    return init + impl::kahan_sum_of<T>(impl::data_of(f_), f_.size());
+  }
+
+  template <typename T>
+  T kahan_sum(const T &init, std::false_type) const {
+    T sum = init;
+    T err = T();
+    apply([&sum, &err](const auto &x) {
+        const T y = static_cast<T>(x) - err;
+        const T t = sum + y;
+        err = (t - sum) - y;
+        sum = t;
+        return true;
+    });
+    return sum;
+  }
+
+  ftl::optional<value_type> max(std::true_type) const {
+    const size_t size = f_.size();
+    if (size == 0) {
+      return ftl::optional<value_type>();
+    }
+    return ftl::optional<value_type>(impl::max_of(impl::data_of(f_), size));
+  }
+
+  ftl::optional<value_type> max(std::false_type) const {
+    return max([](const value_type &x, const value_type &y) { return x < y; });
+  }
+
+  template <typename T, typename U>
+  T reduce(T init, const std::plus<U>&, std::true_type) const {
+    return sum(init, std::true_type());
+  }
+
+  template <typename T, typename U>
+  T reduce(T init, const std::plus<U> &f, std::false_type) const {
+    return reduce(init, [&f](const T &acc, const auto &x) {
+        return f(acc, x);
+    });
+  }
+
+  auto reverse(std::true_type) const {
+    using iterator = std::reverse_iterator<
+        typename std::decay<decltype(f_.begin())>::type>;
+    return seq<impl::seq_iter<iterator>, value_type, Data>(
+        impl::seq_iter<iterator>(iterator(f_.end()), iterator(f_.begin())),
+        data_);
+  }
+
+  auto reverse(std::false_type) const {
+    auto res = this->get_shared();
+    std::reverse(res->begin(), res->end());
+
+    return seq<seq_iter_type, value_type>(
+        seq_iter_type(res->begin(), res->end()), res);
+  }
+
+  template <typename Result>
+  auto split(const value_type &separator, std::true_type) const {
+    auto lambda = split_view(separator).pipe([](const auto &f_prev,
+                                                const auto &f_next) {
+        Result result;
+        f_prev([&f_next, &result](std::string_view token) {
+            result.assign(token.begin(), token.end());
+            return f_next(std::move(result));
+        });
+    }, impl::same_size());
+
+    return seq<decltype(lambda), Result, Data>(lambda, data_);
+  }
+
+  template <typename Result>
+  auto split(const value_type &separator, std::false_type) const {
     auto lambda = pipe([separator](const auto &f_prev, const auto &f_next) {
         Result result;
         bool do_continue = false;
-        f_prev([&f_next, &separator, &result, &do_continue](const auto &x) {
+        f_prev([&f_next, &separator, &result, &do_continue](auto &&x) {
             do_continue = true;
             if (x == separator) {
-              do_continue = f_next(result);
+              do_continue = f_next(std::move(result));
               result.clear();
             } else {
-              result.push_back(x);
+              result.push_back(std::forward<decltype(x)>(x));
             }
             return do_continue;
         });
 
         if (do_continue) {
-          f_next(result);
+          f_next(std::move(result));
         }
     });
 
     return seq<decltype(lambda), Result, Data>(lambda, data_);
   }
 
-  template <typename T=value_type>
-  typename std::enable_if<impl::plus_exists<T>::value, T>::type
-  sum(const T& init=T()) const {
+  auto split_view(const impl::byte_set &separators) const {
+    const auto &begin = f_.begin();
+    const auto size = static_cast<size_t>(f_.end() - begin);
+    const char *data = size > 0 ? &*begin : nullptr;
+    return seq<impl::split_view_gen, std::string_view, Data>(
+        impl::split_view_gen(data, data + size, separators), data_);
+  }
+
+  template <typename T>
+  T sum(const T &init, std::true_type) const {
+    return init + impl::sum_of<T>(impl::data_of(f_), f_.size());
+  }
+
+  template <typename T>
+  T sum(const T &init, std::false_type) const {
     return reduce(init, [](const T &acc, const value_type &x){
         return acc + static_cast<T>(x);
     });
   }
 
-  ftl::optional<value_type> tail() const {
+  ftl::optional<value_type> tail(std::true_type) const {
+    const size_t size = f_.size();
+    if (size == 0) {
+      return ftl::optional<value_type>();
+    }
+    return ftl::optional<value_type>(f_.begin()[size - 1]);
+  }
+
+  ftl::optional<value_type> tail(std::false_type) const {
     ftl::optional<value_type> t;
-    apply([&t](const auto &x){ t = ftl::make_optional(x); return true; });
+    apply([&t](auto &&x){
+        t = ftl::make_optional(std::forward<decltype(x)>(x));
+        return true;
+    });
     return t;
   }
 
-  auto take(const size_t num) {
+  auto take(size_t num, std::true_type) const {
+    return seq<Function, value_type, Data>(
+        f_.slice(0, std::min(num, f_.size())), data_);
+  }
+
+  auto take(size_t num, std::false_type) const {
     auto lambda = pipe([num](const auto &f_prev, const auto &f_next) {
         size_t idx = 0;
-        f_prev([&f_next, &idx, num](const auto &x) {
+        f_prev([&f_next, &idx, num](auto &&x) {
             if (idx < num) {
               ++idx;
-              return f_next(x);
+              return f_next(std::forward<decltype(x)>(x));
             } else {
               return false;
             }
         });
+    }, [num](impl::size_estimate hint) {
+        hint.size = std::min(hint.size, num);
+        return hint;
     });
 
     return seq<decltype(lambda), value_type, Data>(lambda, data_);
   }
 
+  void write_records(impl::record_writer<value_type> &out,
+                     std::true_type) const {
+    out.write(impl::data_of(f_), f_.size());
+  }
+
+  void write_records(impl::record_writer<value_type> &out,
+                     std::false_type) const {
+    apply([&out](const value_type &x) {
+        out.push(x);
+        return true;
+    });
+  }
+
+  Function f_;
+
+  std::shared_ptr<const Data> data_;
+};
+
+/* \brief Parallel view of a sequence
+ *
+ *  The source is cut into several slices per thread and each slice is run
+ *  through the whole pipeline as a task on the executor, which balances
+ *  uneven slices by work stealing. Partial results are combined in order, so
+ *  reduce only requires f to be associative and init to be an identity of f.
+ */
+template <typename Function, typename Value, typename Data>
+class par_seq {
+public:
+  using value_type = Value;
+  using seq_iter_type = typename seq<Function, Value, Data>::seq_iter_type;
+
+  par_seq(const seq<Function, Value, Data> &s, executor &exec,
+          size_t n_threads)
+      : seq_(s), exec_(&exec), n_threads_(std::max<size_t>(n_threads, 1)) { }
+
+  /* \brief Materializes the sequence, evaluating each slice in parallel
+   */
+  auto get() const {
+    impl::check_keeps_views<Data, value_type>();
+    std::vector<std::vector<value_type>> partial(num_slices());
+    for_each_slice([&partial](const auto &gen, size_t idx) {
+        auto &res = partial[idx];
+        impl::reserve(res, impl::get_size_hint(gen));
+        gen([&res](auto &&x){
+            res.emplace_back(std::forward<decltype(x)>(x));
+            return true;
+        });
+    });
+    return concat(partial,
+                  std::is_default_constructible<value_type>());
+  }
+
+  auto get_shared() const {
+    return impl::share(this->get(), seq_.data_, impl::is_view<value_type>());
+  }
+
+  auto eval() const {
+    auto res = this->get_shared();
+    return seq<seq_iter_type, value_type>(
+        seq_iter_type(res->begin(), res->end()), res);
+  }
+
   template <typename Func>
-  auto take_while(const Func &f) const {
-    auto lambda = pipe([f](const auto &f_prev, const auto &f_next) {
-        f_prev([&f_next, &f](const auto &x){
+  bool all(const Func &f) const {
+    return !any([&f](const auto &x) { return !f(x); });
+  }
+
+  template <typename T=value_type>
+  typename std::enable_if<impl::bool_exists<T>::value, bool>::type
+  all() const {
+    return all([](const T &x) { return static_cast<bool>(x); });
+  }
+
+  template <typename Func>
+  bool any(const Func &f) const {
+    std::atomic<bool> test(false);
+    for_each_slice([&test, &f](const auto &gen, size_t) {
+        gen([&test, &f](const auto &x) {
+            if (test.load(std::memory_order_relaxed)) {
+              return false;
+            }
             if (f(x)) {
-              return f_next(x);
-            } else {
+              test.store(true, std::memory_order_relaxed);
               return false;
             }
+            return true;
         });
     });
+    return test.load();
+  }
 
-    return seq<decltype(lambda), value_type, Data>(lambda, data_);
+  template <typename T=value_type>
+  typename std::enable_if<impl::bool_exists<T>::value, bool>::type
+  any() const {
+    return any([](const T &x) { return static_cast<bool>(x); });
   }
 
   template <typename Func>
-  auto uniq(const Func &f) const {
-    auto lambda = pipe([f](const auto &f_prev, const auto &f_next) {
-        std::set<decltype(f(impl::instance_of<value_type>()))> vals;
-        f_prev([&f_next, &f, &vals](const auto &x){
-            const auto fx = f(x);
-            const auto it = vals.find(fx);
-            if (it == vals.end()) {
-              vals.insert(fx);
-              return f_next(x);
+  size_t count(const Func &f) const {
+    return reduce(size_t(0),
+        [&f](size_t acc, const auto &x) { return f(x) ? acc + 1 : acc; },
+        [](size_t acc, size_t num) { return acc + num; });
+  }
+
+  size_t count() const {
+    return impl::is_random_access_source<Function>::value
+        ? seq_.count() : count([](const auto&){ return true; });
+  }
+
+  template <typename Func>
+  ftl::optional<value_type> max(const Func &cmp) const {
+    impl::check_keeps_views<Data, value_type>();
+    std::vector<ftl::optional<value_type>> partial(num_slices());
+    for_each_slice([&partial, &cmp](const auto &gen, size_t idx) {
+        auto &res = partial[idx];
+        gen([&res, &cmp](auto &&x) {
+            if (!res || cmp(*res, x)) {
+              res = ftl::optional<value_type>(std::forward<decltype(x)>(x));
             }
             return true;
         });
     });
 
-    return seq<decltype(lambda), value_type>(lambda, data_);
+    ftl::optional<value_type> res;
+    for (const auto &x : partial) {
+      if (x && (!res || cmp(*res, *x))) {
+        res = x;
+      }
+    }
+    return res;
   }
 
-  auto uniq() const {
-    return uniq(identity());
+  template <typename T=value_type>
+  typename std::enable_if<impl::lt_exists<T>::value, ftl::optional<T>>::type
+  max() const {
+    return max(typename impl::is_simd_source<Function>::type());
   }
 
-  auto with_index() const {
-    auto lambda = pipe([](const auto &f_prev, const auto &f_next) {
-        size_t idx = 0;
-        f_prev([&f_next, &idx](const auto &x) {
-            return f_next(std::make_tuple(idx++, x));
+  /* \brief Sorts runs of the materialized sequence in parallel, then merges
+   *  neighbouring runs pairwise, one level of the merge tree at a time
+   *
+   *  Each merge is cut into pieces at co-ranked split points, so every level
+   *  keeps all threads busy, including the last one.
+   */
+  template <typename Func>
+  auto sorted(const Func &cmp) const {
+    auto res = this->get_shared();
+    const size_t size = res->size();
+    const size_t runs = std::max<size_t>(std::min(n_threads_, size), 1);
+    const auto run = [size, runs](size_t idx) {
+        return std::min(idx, runs) * size / runs;
+    };
+
+    const auto begin = res->begin();
+    exec_->parallel_for(0, runs, 1, [&](size_t first, size_t last) {
+        for (size_t idx = first; idx < last; ++idx) {
+          std::sort(begin + run(idx), begin + run(idx + 1), cmp);
+        }
+    });
+
+    merge_runs(*res, runs, run, cmp,
+               std::is_default_constructible<value_type>());
+
+    return seq<seq_iter_type, value_type>(
+        seq_iter_type(res->begin(), res->end()), res);
+  }
+
+  template <typename T=Value>
+  typename std::enable_if<
+      impl::lt_exists<T>::value,
+      seq<impl::seq_iter<typename std::vector<value_type>::iterator>,
+          value_type>>::type
+  sorted() const {
+    return sorted([](const auto &x, const auto &y) { return x < y; });
+  }
+
+  template <typename T, typename Func, typename Combine>
+  T reduce(const T &init, const Func &f, const Combine &combine) const {
+    std::vector<T> partial(num_slices(), init);
+    for_each_slice([&partial, &f](const auto &gen, size_t idx) {
+        auto &acc = partial[idx];
+        impl::for_each_batch(gen, [&acc, &f](const auto &get, size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+              acc = f(acc, get(i));
+            }
+            return true;
         });
     });
 
-    return seq<decltype(lambda), std::tuple<size_t, value_type>, Data>(lambda,
-        data_);
+    T res = partial.front();
+    for (size_t i = 1; i < partial.size(); ++i) {
+      res = combine(res, partial[i]);
+    }
+    return res;
+  }
+
+  template <typename T, typename Func>
+  T reduce(const T &init, const Func &f) const {
+    return reduce(init, f, f);
+  }
+
+  template <typename T=value_type>
+  typename std::enable_if<impl::plus_exists<T>::value, T>::type
+  sum(const T& init=T()) const {
+    return sum(init, std::integral_constant<
+        bool,
+        impl::is_simd_source<Function>::value &&
+        impl::is_simd_arithmetic<T>::value>());
   }
 
 private:
-  Function f_;
+  static constexpr bool splittable = impl::is_splittable<Function>::value;
+  static constexpr size_t slices_per_thread = 8;
+
+  ftl::optional<value_type> max(std::true_type) const {
+    std::vector<ftl::optional<value_type>> partial(num_slices());
+    for_each_slice([&partial](const auto &gen, size_t idx) {
+        if (gen.size() > 0) {
+          partial[idx] = ftl::optional<value_type>(
+              impl::max_of(impl::data_of(gen), gen.size()));
+        }
+    });
 
-  std::shared_ptr<const Data> data_;
+    ftl::optional<value_type> res;
+    for (const auto &x : partial) {
+      if (x && (!res || *res < *x)) {
+        res = x;
+      }
+    }
+    return res;
+  }
+
+  ftl::optional<value_type> max(std::false_type) const {
+    return max([](const value_type &x, const value_type &y) { return x < y; });
+  }
+
+  /* \brief Merges the sorted runs [run(idx), run(idx + 1)) of v, moving the
+   *  values back and forth between v and a buffer of the same size
+   */
+  template <typename Run, typename Func>
+  void merge_runs(std::vector<value_type> &v, size_t runs, const Run &run,
+                  const Func &cmp, std::true_type) const {
+    if (runs < 2) {
+      return;
+    }
+    std::vector<value_type> buffer(v.size());
+    std::vector<value_type> *src = &v;
+    std::vector<value_type> *dst = &buffer;
+    for (size_t width = 1; width < runs; width *= 2) {
+      const size_t pairs = (runs + 2 * width - 1) / (2 * width);
+      const size_t parts = (n_threads_ + pairs - 1) / pairs;
+      const auto bounds = [&run, width, parts](size_t idx) {
+          const size_t lo = 2 * (idx / (parts + 1)) * width;
+          return std::make_tuple(run(lo), run(lo + width),
+                                 run(lo + 2 * width));
+      };
+      const auto out_pos = [parts](size_t idx, size_t l, size_t r) {
+          return (idx % (parts + 1)) * (r - l) / parts;
+      };
+
+      // All split points are found before any value is moved out of src
+      std::vector<size_t> split(pairs * (parts + 1));
+      const std::vector<value_type> &in = *src;
+      exec_->parallel_for(0, split.size(), 16, [&](size_t first,
+                                                   size_t last) {
+          for (size_t idx = first; idx < last; ++idx) {
+            size_t l, m, r;
+            std::tie(l, m, r) = bounds(idx);
+            split[idx] = impl::co_rank(out_pos(idx, l, r), in.begin() + l,
+                                       m - l, in.begin() + m, r - m, cmp);
+          }
+      });
+
+      exec_->parallel_for(0, pairs * parts, 1, [&](size_t first,
+                                                   size_t last) {
+          for (size_t piece = first; piece < last; ++piece) {
+            const size_t idx = piece + piece / parts;
+            size_t l, m, r;
+            std::tie(l, m, r) = bounds(idx);
+            const size_t k0 = out_pos(idx, l, r);
+            const size_t k1 = out_pos(idx + 1, l, r);
+            const size_t i0 = split[idx];
+            const size_t i1 = split[idx + 1];
+
+            const auto a = src->begin() + l;
+            const auto b = src->begin() + m;
+            impl::move_merge(a + i0, a + i1, b + (k0 - i0), b + (k1 - i1),
+                             dst->begin() + l + k0, cmp);
+          }
+      });
+      std::swap(src, dst);
+    }
+    if (src != &v) {
+      v.swap(buffer);
+    }
+  }
+
+  template <typename Run, typename Func>
+  void merge_runs(std::vector<value_type> &v, size_t runs, const Run &run,
+                  const Func &cmp, std::false_type) const {
+    const auto begin = v.begin();
+    for (size_t width = 1; width < runs; width *= 2) {
+      const size_t pairs = (runs + 2 * width - 1) / (2 * width);
+      exec_->parallel_for(0, pairs, 1, [&](size_t first, size_t last) {
+          for (size_t idx = first; idx < last; ++idx) {
+            const size_t lo = 2 * idx * width;
+            std::inplace_merge(begin + run(lo), begin + run(lo + width),
+                               begin + run(lo + 2 * width), cmp);
+          }
+      });
+    }
+  }
+
+  template <typename T>
+  T sum(const T &init, std::true_type) const {
+    std::vector<T> partial(num_slices());
+    for_each_slice([&partial](const auto &gen, size_t idx) {
+        partial[idx] = impl::sum_of<T>(impl::data_of(gen), gen.size());
+    });
+
+    T res = init;
+    for (const auto &x : partial) {
+      res += x;
+    }
+    return res;
+  }
+
+  template <typename T>
+  T sum(const T &init, std::false_type) const {
+    const auto plus = [](const T &acc, const T &x) { return acc + x; };
+    return init + reduce(T(),
+        [](const T &acc, const value_type &x) {
+            return acc + static_cast<T>(x);
+        },
+        plus);
+  }
+
+  size_t num_slices() const {
+    return num_slices(std::integral_constant<bool, splittable>());
+  }
+
+  size_t num_slices(std::true_type) const {
+    return std::max<size_t>(
+        std::min(n_threads_ * slices_per_thread, seq_.f_.size()), 1);
+  }
+
+  size_t num_slices(std::false_type) const {
+    return 1;
+  }
+
+  /* \brief Moves the partial results into a single vector, in parallel if
+   *  the elements can be default constructed up front
+   */
+  std::vector<value_type> concat(std::vector<std::vector<value_type>> &partial,
+                                 std::true_type) const {
+    if (partial.size() == 1) {
+      return std::move(partial.front());
+    }
+    std::vector<size_t> offset(1, 0);
+    for (const auto &x : partial) {
+      offset.push_back(offset.back() + x.size());
+    }
+    std::vector<value_type> res(offset.back());
+    exec_->parallel_for(0, partial.size(), 1, [&](size_t first, size_t last) {
+        for (size_t idx = first; idx < last; ++idx) {
+          std::move(partial[idx].begin(), partial[idx].end(),
+                    res.begin() + offset[idx]);
+        }
+    });
+    return res;
+  }
+
+  std::vector<value_type> concat(std::vector<std::vector<value_type>> &partial,
+                                 std::false_type) const {
+    std::vector<value_type> res = std::move(partial.front());
+    for (size_t idx = 1; idx < partial.size(); ++idx) {
+      res.insert(res.end(), std::make_move_iterator(partial[idx].begin()),
+                 std::make_move_iterator(partial[idx].end()));
+    }
+    return res;
+  }
+
+  /* \brief Calls f(gen, idx) for each slice in parallel
+   */
+  template <typename Func>
+  void for_each_slice(const Func &f) const {
+    for_each_slice(f, std::integral_constant<bool, splittable>());
+  }
+
+  template <typename Func>
+  void for_each_slice(const Func &f, std::true_type) const {
+    const size_t num = num_slices();
+    const size_t size = seq_.f_.size();
+    exec_->parallel_for(0, num, 1, [this, &f, num, size](size_t begin,
+                                                         size_t end) {
+        for (size_t idx = begin; idx < end; ++idx) {
+          f(seq_.f_.slice(idx * size / num, (idx + 1) * size / num), idx);
+        }
+    });
+  }
+
+  template <typename Func>
+  void for_each_slice(const Func &f, std::false_type) const {
+    f(seq_.f_, 0);
+  }
+
+  seq<Function, Value, Data> seq_;
+  executor *exec_;
+  size_t n_threads_;
 };
 
 template <typename Iter>
 auto make_seq(const Iter &begin, const Iter &end) {
-  return seq<impl::seq_iter<Iter>, typename Iter::value_type>(
+  return seq<impl::seq_iter<Iter>,
+             typename std::iterator_traits<Iter>::value_type>(
       impl::seq_iter<Iter>(begin, end));
 }
 
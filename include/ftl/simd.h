@@ -0,0 +1,436 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define FTL_SIMD_AVX2_DISPATCH
+#endif
+
+#if defined(__GNUC__)
+#define FTL_SIMD_VECTOR_EXT
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#define FTL_SIMD_VECTOR_SELECT
+#endif
+
+namespace ftl {
+namespace impl {
+
+/* \brief Small set of bytes to scan for, such as a list of separators
+ */
+class byte_set {
+public:
+  static constexpr size_t max_size = 8;
+
+  byte_set(const char *bytes, size_t size) : size_(size), table_() {
+    if (size == 0 || size > max_size) {
+      throw std::invalid_argument("ftl: byte_set takes 1 to 8 bytes");
+    }
+    for (size_t idx = 0; idx < size; ++idx) {
+      bytes_[idx] = bytes[idx];
+      table_[static_cast<unsigned char>(bytes[idx])] = true;
+    }
+  }
+
+  bool contains(char c) const {
+    return table_[static_cast<unsigned char>(c)];
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  char operator[](size_t idx) const {
+    return bytes_[idx];
+  }
+
+private:
+  char bytes_[max_size];
+  size_t size_;
+  bool table_[256];
+};
+
+inline size_t lowest_set_bit(uint32_t bits) {
+#if defined(__GNUC__)
+  return static_cast<size_t>(__builtin_ctz(bits));
+#else
+  size_t idx = 0;
+  while ((bits & 1) == 0) {
+    bits >>= 1;
+    ++idx;
+  }
+  return idx;
+#endif
+}
+
+/* \brief Calls f(pos) for every position in [first, last) holding a byte
+ *  from the set, in order, stopping early if f returns false
+ *
+ *  Returns false if f stopped the scan.
+ */
+template <typename Func>
+bool for_each_of_scalar(const char *first, const char *last,
+                        const byte_set &set, const Func &f) {
+  for (const char *it = first; it != last; ++it) {
+    if (set.contains(*it) && !f(it)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* \brief Calls f for each set bit of a block mask, lowest first
+ */
+template <typename Func>
+bool for_each_bit(const char *block, uint32_t mask, const Func &f) {
+  for (; mask != 0; mask &= mask - 1) {
+    if (!f(block + lowest_set_bit(mask))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#if defined(__SSE2__)
+template <typename Func>
+bool for_each_of_sse2(const char *first, const char *last,
+                      const byte_set &set, const Func &f) {
+  __m128i needles[byte_set::max_size];
+  for (size_t idx = 0; idx < set.size(); ++idx) {
+    needles[idx] = _mm_set1_epi8(set[idx]);
+  }
+  for (; last - first >= 16; first += 16) {
+    const __m128i block = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(first));
+    __m128i eq = _mm_cmpeq_epi8(block, needles[0]);
+    for (size_t idx = 1; idx < set.size(); ++idx) {
+      eq = _mm_or_si128(eq, _mm_cmpeq_epi8(block, needles[idx]));
+    }
+    const uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(eq));
+    if (!for_each_bit(first, mask, f)) {
+      return false;
+    }
+  }
+  return for_each_of_scalar(first, last, set, f);
+}
+#endif
+
+#if defined(FTL_SIMD_AVX2_DISPATCH)
+template <typename Func>
+__attribute__((target("avx2")))
+bool for_each_of_avx2(const char *first, const char *last,
+                      const byte_set &set, const Func &f) {
+  __m256i needles[byte_set::max_size];
+  for (size_t idx = 0; idx < set.size(); ++idx) {
+    needles[idx] = _mm256_set1_epi8(set[idx]);
+  }
+  for (; last - first >= 32; first += 32) {
+    const __m256i block = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(first));
+    __m256i eq = _mm256_cmpeq_epi8(block, needles[0]);
+    for (size_t idx = 1; idx < set.size(); ++idx) {
+      eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(block, needles[idx]));
+    }
+    const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(eq));
+    if (!for_each_bit(first, mask, f)) {
+      return false;
+    }
+  }
+  return for_each_of_scalar(first, last, set, f);
+}
+
+inline bool cpu_has_avx2() {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  return has_avx2;
+}
+#endif
+
+/* \brief Calls f(pos) for every position in [first, last) holding a byte
+ *  from the set, in order, stopping early if f returns false
+ *
+ *  Compares 32 bytes at a time with AVX2 when the CPU supports it, else 16
+ *  at a time with SSE2, else one at a time. Returns false if f stopped the
+ *  scan.
+ */
+template <typename Func>
+bool for_each_of(const char *first, const char *last, const byte_set &set,
+                 const Func &f) {
+#if defined(FTL_SIMD_AVX2_DISPATCH)
+  if (cpu_has_avx2()) {
+    return for_each_of_avx2(first, last, set, f);
+  }
+#endif
+#if defined(__SSE2__)
+  return for_each_of_sse2(first, last, set, f);
+#else
+  return for_each_of_scalar(first, last, set, f);
+#endif
+}
+
+/* \brief Arithmetic types handled by the kernels below
+ */
+template <typename T>
+struct is_simd_arithmetic
+    : std::integral_constant<bool, std::is_arithmetic<T>::value &&
+                                   !std::is_same<T, bool>::value &&
+                                   sizeof(T) <= 8> { };
+
+template <typename Acc, typename T>
+Acc sum_of_scalar(const T *data, size_t n) {
+  Acc res[4] = { };
+  size_t idx = 0;
+  for (; idx + 4 <= n; idx += 4) {
+    for (size_t k = 0; k < 4; ++k) {
+      res[k] += static_cast<Acc>(data[idx + k]);
+    }
+  }
+  for (; idx < n; ++idx) {
+    res[0] += static_cast<Acc>(data[idx]);
+  }
+  return (res[0] + res[1]) + (res[2] + res[3]);
+}
+
+template <typename Acc, typename T>
+Acc kahan_sum_of_scalar(const T *data, size_t n) {
+  Acc sum = Acc();
+  Acc err = Acc();
+  for (size_t idx = 0; idx < n; ++idx) {
+    const Acc y = static_cast<Acc>(data[idx]) - err;
+    const Acc t = sum + y;
+    err = (t - sum) - y;
+    sum = t;
+  }
+  return sum;
+}
+
+template <typename T>
+T max_of_scalar(const T *data, size_t n) {
+  T res = data[0];
+  for (size_t idx = 1; idx < n; ++idx) {
+    if (res < data[idx]) {
+      res = data[idx];
+    }
+  }
+  return res;
+}
+
+#if defined(FTL_SIMD_VECTOR_EXT)
+/* \brief Vector of Lanes elements of T, using the GCC/Clang vector
+ *  extensions so that one template covers every arithmetic type
+ */
+template <typename T, size_t Lanes>
+struct simd_vec {
+  typedef T type __attribute__((vector_size(Lanes * sizeof(T))));
+};
+
+template <typename Vec, typename T>
+__attribute__((always_inline))
+inline void load_vec(Vec &res, const T *data) {
+  std::memcpy(&res, data, sizeof(res));
+}
+
+/* \brief Adds up data in 4 independent vector accumulators of 32 bytes
+ */
+template <typename Acc, typename T>
+__attribute__((always_inline))
+inline Acc sum_of_vec(const T *data, size_t n) {
+  constexpr size_t lanes = 32 / sizeof(Acc);
+  using acc_vec = typename simd_vec<Acc, lanes>::type;
+  using in_vec = typename simd_vec<T, lanes>::type;
+
+  acc_vec acc[4] = { };
+  in_vec x;
+  size_t idx = 0;
+  for (; idx + 4 * lanes <= n; idx += 4 * lanes) {
+    for (size_t k = 0; k < 4; ++k) {
+      load_vec(x, data + idx + k * lanes);
+      acc[k] += __builtin_convertvector(x, acc_vec);
+    }
+  }
+  const acc_vec total = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+  Acc res = Acc();
+  for (size_t k = 0; k < lanes; ++k) {
+    res += total[k];
+  }
+  return res + sum_of_scalar<Acc>(data + idx, n - idx);
+}
+
+/* \brief Kahan summation run independently in each lane of 4 vector
+ *  accumulators, whose results are then combined with Kahan summation too
+ */
+template <typename Acc, typename T>
+__attribute__((always_inline))
+inline Acc kahan_sum_of_vec(const T *data, size_t n) {
+  constexpr size_t lanes = 32 / sizeof(Acc);
+  using acc_vec = typename simd_vec<Acc, lanes>::type;
+  using in_vec = typename simd_vec<T, lanes>::type;
+
+  acc_vec sum[4] = { };
+  acc_vec err[4] = { };
+  in_vec x;
+  size_t idx = 0;
+  for (; idx + 4 * lanes <= n; idx += 4 * lanes) {
+    for (size_t k = 0; k < 4; ++k) {
+      load_vec(x, data + idx + k * lanes);
+      const acc_vec y = __builtin_convertvector(x, acc_vec) - err[k];
+      const acc_vec t = sum[k] + y;
+      err[k] = (t - sum[k]) - y;
+      sum[k] = t;
+    }
+  }
+
+  Acc partial[4 * lanes + 1];
+  for (size_t k = 0; k < 4; ++k) {
+    for (size_t lane = 0; lane < lanes; ++lane) {
+      partial[k * lanes + lane] = sum[k][lane] - err[k][lane];
+    }
+  }
+  partial[4 * lanes] = kahan_sum_of_scalar<Acc>(data + idx, n - idx);
+  return kahan_sum_of_scalar<Acc>(partial, 4 * lanes + 1);
+}
+#endif
+
+#if defined(FTL_SIMD_VECTOR_SELECT)
+/* \brief Running maximum of 4 vector accumulators. Lanes only move on to a
+ *  strictly greater value, like the scalar version, so NaNs after the first
+ *  element are skipped.
+ */
+template <typename T>
+__attribute__((always_inline))
+inline T max_of_vec(const T *data, size_t n) {
+  constexpr size_t lanes = 32 / sizeof(T);
+  using vec = typename simd_vec<T, lanes>::type;
+
+  if (n < 4 * lanes) {
+    return max_of_scalar(data, n);
+  }
+  vec acc[4];
+  for (size_t k = 0; k < 4; ++k) {
+    acc[k] = vec() + data[0];
+  }
+  vec x;
+  size_t idx = 0;
+  for (; idx + 4 * lanes <= n; idx += 4 * lanes) {
+    for (size_t k = 0; k < 4; ++k) {
+      load_vec(x, data + idx + k * lanes);
+      acc[k] = acc[k] < x ? x : acc[k];
+    }
+  }
+  T res = data[0];
+  for (size_t k = 0; k < 4; ++k) {
+    for (size_t lane = 0; lane < lanes; ++lane) {
+      if (res < acc[k][lane]) {
+        res = acc[k][lane];
+      }
+    }
+  }
+  for (; idx < n; ++idx) {
+    if (res < data[idx]) {
+      res = data[idx];
+    }
+  }
+  return res;
+}
+#endif
+
+#if defined(FTL_SIMD_AVX2_DISPATCH) && defined(FTL_SIMD_VECTOR_EXT)
+template <typename Acc, typename T>
+__attribute__((target("avx2")))
+Acc sum_of_avx2(const T *data, size_t n) {
+  return sum_of_vec<Acc>(data, n);
+}
+
+template <typename Acc, typename T>
+__attribute__((target("avx2")))
+Acc kahan_sum_of_avx2(const T *data, size_t n) {
+  return kahan_sum_of_vec<Acc>(data, n);
+}
+#endif
+
+#if defined(FTL_SIMD_AVX2_DISPATCH) && defined(FTL_SIMD_VECTOR_SELECT)
+template <typename T>
+__attribute__((target("avx2")))
+T max_of_avx2(const T *data, size_t n) {
+  return max_of_vec(data, n);
+}
+#endif
+
+/* \brief Sum of n values as Acc, added up in several independent lanes
+ *
+ *  For floating point this is not bit-identical to a left fold, but it is
+ *  usually closer to the exact sum, since each lane adds up fewer values.
+ */
+template <typename Acc, typename T>
+Acc sum_of(const T *data, size_t n) {
+#if defined(FTL_SIMD_AVX2_DISPATCH) && defined(FTL_SIMD_VECTOR_EXT)
+  if (cpu_has_avx2()) {
+    return sum_of_avx2<Acc>(data, n);
+  }
+#endif
+#if defined(FTL_SIMD_VECTOR_EXT)
+  return sum_of_vec<Acc>(data, n);
+#else
+  return sum_of_scalar<Acc>(data, n);
+#endif
+}
+
+/* \brief Compensated (Kahan) sum of n values as floating point Acc
+ *
+ *  The compensation is only preserved if the code is not compiled with
+ *  -ffast-math or similar flags that allow reassociation.
+ */
+template <typename Acc, typename T>
+Acc kahan_sum_of(const T *data, size_t n) {
+#if defined(FTL_SIMD_AVX2_DISPATCH) && defined(FTL_SIMD_VECTOR_EXT)
+  if (cpu_has_avx2()) {
+    return kahan_sum_of_avx2<Acc>(data, n);
+  }
+#endif
+#if defined(FTL_SIMD_VECTOR_EXT)
+  return kahan_sum_of_vec<Acc>(data, n);
+#else
+  return kahan_sum_of_scalar<Acc>(data, n);
+#endif
+}
+
+/* \brief Largest of n > 0 values, keeping the first one on ties
+ */
+template <typename T>
+T max_of(const T *data, size_t n) {
+#if defined(FTL_SIMD_AVX2_DISPATCH) && defined(FTL_SIMD_VECTOR_SELECT)
+  if (cpu_has_avx2()) {
+    return max_of_avx2(data, n);
+  }
+#endif
+#if defined(FTL_SIMD_VECTOR_SELECT)
+  return max_of_vec(data, n);
+#else
+  return max_of_scalar(data, n);
+#endif
+}
+
+/* \brief First position in [first, last) holding a byte from the set, or
+ *  last
+ */
+inline const char* find_any(const char *first, const char *last,
+                            const byte_set &set) {
+  const char *res = last;
+  for_each_of(first, last, set, [&res](const char *pos) {
+      res = pos;
+      return false;
+  });
+  return res;
+}
+
+}  // namespace impl
+}  // namespace ftl
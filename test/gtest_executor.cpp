@@ -0,0 +1,121 @@
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <ftl/ftl.h>
+
+class ExecutorTest : public ::testing::Test {
+public:
+  ExecutorTest() : exec(4) { }
+
+  ftl::executor exec;
+};
+
+TEST_F(ExecutorTest, ParallelFor) {
+  std::vector<int> visited(1000, 0);
+  exec.parallel_for(0, visited.size(), 7, [&visited](let begin, let end) {
+      for (size_t i = begin; i < end; ++i) {
+        visited[i] += 1;
+      }
+  });
+
+  for (let x : visited) {
+    EXPECT_EQ(x, 1);
+  }
+}
+
+TEST_F(ExecutorTest, Nested) {
+  std::atomic<int> num(0);
+  exec.parallel_for(0, 100, 1, [this, &num](let begin, let end) {
+      for (size_t i = begin; i < end; ++i) {
+        exec.parallel_for(0, i, 1, [&num](let b, let e) {
+            num += static_cast<int>(e - b);
+        });
+      }
+  });
+  EXPECT_EQ(num, 4950);
+}
+
+TEST_F(ExecutorTest, NestedFromManyThreads) {
+  std::atomic<int> num(0);
+  std::vector<std::thread> callers;
+  for (int t = 0; t < 6; ++t) {
+    callers.emplace_back([this, &num]() {
+        for (int rep = 0; rep < 20; ++rep) {
+          exec.parallel_for(0, 20, 1, [this, &num](let begin, let end) {
+              for (size_t i = begin; i < end; ++i) {
+                exec.parallel_for(0, i, 1, [&num](let b, let e) {
+                    num += static_cast<int>(e - b);
+                });
+              }
+          });
+        }
+    });
+  }
+  for (auto &caller : callers) {
+    caller.join();
+  }
+  EXPECT_EQ(num, 6 * 20 * 190);
+}
+
+TEST_F(ExecutorTest, WaitBlocks) {
+  std::atomic<bool> started(false);
+  bool saw_sleep = false;
+  exec.parallel_for(0, 2, 1, [this, &started, &saw_sleep](let begin, let) {
+      if (begin == 0) {
+        // Leave the other half to a worker, then go wait for it
+        while (!started) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return;
+      }
+      started = true;
+      const auto deadline = std::chrono::steady_clock::now() +
+          std::chrono::seconds(20);
+      while (!saw_sleep && std::chrono::steady_clock::now() < deadline) {
+        saw_sleep = exec.sleeping() > 0;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+  });
+  EXPECT_TRUE(saw_sleep);
+  EXPECT_EQ(exec.sleeping(), 0);
+}
+
+TEST_F(ExecutorTest, Invoke) {
+  int a = 0;
+  int b = 0;
+  exec.invoke([&a]() { a = 1; }, [&b]() { b = 2; });
+  EXPECT_EQ(a, 1);
+  EXPECT_EQ(b, 2);
+}
+
+TEST_F(ExecutorTest, Exception) {
+  EXPECT_THROW(
+      exec.parallel_for(0, 100, 1, [](let begin, let) {
+          if (begin == 42) {
+            throw std::runtime_error("42");
+          }
+      }),
+      std::runtime_error);
+}
+
+TEST_F(ExecutorTest, NestedSeq) {
+  std::vector<int> a;
+  for (int i = 1; i <= 200; ++i) {
+    a.push_back(i);
+  }
+  let s = ftl::make_seq(a.begin(), a.end());
+
+  let res = s
+      .map([&s](let x) {
+          return s.take_while([x](let y){ return y <= x; }).eval();
+      })
+      .map([this](let inner){ return inner.par(exec).sum(); })
+      .par(exec)
+      .sum();
+  EXPECT_EQ(res, 1353400);
+}
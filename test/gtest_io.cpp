@@ -0,0 +1,303 @@
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <ftl/ftl.h>
+
+class IoTest : public ::testing::Test {
+public:
+  IoTest() : path(::testing::TempDir() + "ftl_io_test") { }
+
+  ~IoTest() {
+    std::remove(path.c_str());
+  }
+
+  void write(const std::string &contents) const {
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    f << contents;
+  }
+
+  std::vector<std::string> getlines(const std::string &contents) const {
+    std::istringstream f(contents);
+    std::vector<std::string> res;
+    for (std::string line; std::getline(f, line); ) {
+      res.push_back(line);
+    }
+    return res;
+  }
+
+  std::vector<std::string> mmap_lines() const {
+    return ftl::mmap_lines(path)
+        .map([](let x){ return std::string(x); })
+        .get();
+  }
+
+  const std::string path;
+};
+
+TEST_F(IoTest, MmapLines) {
+  for (let contents : {"", "\n", "a", "a\n", "a\nbb\n\nccc", "\n\nx\n\n"}) {
+    write(contents);
+    EXPECT_EQ(mmap_lines(), getlines(contents));
+  }
+}
+
+TEST_F(IoTest, MmapLinesLong) {
+  std::string contents;
+  for (int i = 0; i < 10000; ++i) {
+    contents += std::to_string(i * i) + (i % 7 == 0 ? "\n\n" : "\n");
+  }
+  write(contents);
+  EXPECT_EQ(mmap_lines(), getlines(contents));
+  EXPECT_EQ(ftl::mmap_lines(path).count(), getlines(contents).size());
+  EXPECT_EQ(ftl::mmap_lines(path)
+                .filter([](let x){ return x.empty(); })
+                .count(),
+            1429);
+}
+
+TEST_F(IoTest, MmapLinesKeepsFileMapped) {
+  write("b\na\nb\nc\n");
+  let lines = ftl::mmap_lines(path).uniq().eval();
+  std::remove(path.c_str());
+  EXPECT_EQ(lines.get(), std::vector<std::string_view>({"b", "a", "c"}));
+}
+
+TEST_F(IoTest, ParMmapLines) {
+  std::string contents;
+  for (int i = 0; i < 20000; ++i) {
+    contents += std::to_string(i) + (i % 5 == 0 ? "\n\n" : "\n");
+  }
+  let lines = getlines(contents);
+  let is_odd = [](let x){ return !x.empty() && (x.back() - '0') % 2 == 1; };
+  let length = [](let x){ return x.size(); };
+
+  for (let tail : {"", "x", "\n"}) {
+    write(contents + tail);
+    let s = ftl::mmap_lines(path);
+    let expected = getlines(contents + tail);
+    EXPECT_EQ(s.par(4).count(), expected.size());
+    EXPECT_EQ(s.filter(is_odd).par(4).count(), s.filter(is_odd).count());
+    EXPECT_EQ(s.map(length).par(4).sum(), s.map(length).sum());
+    EXPECT_EQ(s.par(8).reduce(size_t(0),
+        [](size_t acc, let x){ return std::max(acc, x.size()); },
+        [](size_t acc, size_t x){ return std::max(acc, x); }), 5);
+    EXPECT_EQ(s.map([](let x){ return std::string(x); }).par(4).get(),
+              expected);
+  }
+
+  let indexed = ftl::mmap_lines(path).with_index()
+      .map([](let x){ return std::get<0>(x); })
+      .par(4)
+      .get();
+  EXPECT_EQ(indexed.size(), lines.size() + 1);
+  EXPECT_EQ(indexed.back(), lines.size());
+}
+
+TEST_F(IoTest, ReadLines) {
+  std::string contents;
+  for (int i = 0; i < 5000; ++i) {
+    contents += std::string(i % 37, 'a' + i % 26) + "\n";
+  }
+  contents += "last";
+  write(contents);
+
+  for (size_t buffer_size : {1, 7, 64, 1 << 20}) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(ftl::read_lines(fd, buffer_size).owned().get(),
+              getlines(contents));
+    ::close(fd);
+  }
+}
+
+TEST_F(IoTest, ReadLinesPipe) {
+  int fds[2];
+  ASSERT_EQ(::pipe(fds), 0);
+  std::thread writer([&fds]() {
+      const std::string line = "0123456789\n";
+      for (int i = 0; i < 100000; ++i) {
+        EXPECT_EQ(::write(fds[1], line.data(), line.size()), line.size());
+      }
+      ::close(fds[1]);
+  });
+
+  const size_t num = ftl::read_lines(fds[0], 4096)
+      .filter([](let x){ return x == "0123456789"; })
+      .count();
+  writer.join();
+  ::close(fds[0]);
+  EXPECT_EQ(num, 100000);
+}
+
+TEST_F(IoTest, ReadLinesOwnedStages) {
+  write("ab\ncd\nab\nef\ngh\ngh\n");
+  const auto lines = [this](const auto &f) {
+      const int fd = ::open(path.c_str(), O_RDONLY);
+      EXPECT_GE(fd, 0);
+      const auto res = f(ftl::read_lines(fd, 4).owned());
+      ::close(fd);
+      return res;
+  };
+
+  EXPECT_EQ(lines([](let s){ return s.head(); }), std::string("ab"));
+  EXPECT_EQ(lines([](let s){ return s.tail(); }), std::string("gh"));
+  EXPECT_EQ(lines([](let s){ return s.max(); }), std::string("gh"));
+  EXPECT_EQ(lines([](let s){ return s.uniq().count(); }), 4);
+  EXPECT_EQ(lines([](let s){ return s.dedup().count(); }), 5);
+  EXPECT_EQ(lines([](let s){ return s.async_buffer(2).count(); }), 6);
+  EXPECT_EQ(lines([](let s){
+      return s.par_map([](let x){ return x.size(); }, 2).sum(); }), 12);
+
+  // Keys that own their data may be taken from the views themselves
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ(ftl::read_lines(fd, 4)
+                .uniq([](let x){ return std::string(x); })
+                .count(),
+            4);
+  ::close(fd);
+}
+
+TEST_F(IoTest, ReadLinesViewsInTuples) {
+  using indexed = decltype(ftl::read_lines(0).with_index());
+  static_assert(!ftl::impl::keeps_views<ftl::impl::reused_buffer,
+                                        indexed::value_type>::value,
+                "with_index().get() must require owned()");
+  static_assert(!ftl::impl::keeps_views<
+                    ftl::impl::reused_buffer,
+                    std::pair<std::string_view, size_t>>::value,
+                "pairs of views must require owned()");
+  static_assert(ftl::impl::is_view<
+                    ftl::optional<std::tuple<int, std::string_view>>>::value,
+                "views nest through optional and tuple");
+
+  write("ab\ncd\nef\n");
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  let res = ftl::read_lines(fd, 2).with_index().owned().get();
+  ::close(fd);
+  ASSERT_EQ(res.size(), 3);
+  EXPECT_EQ(res[2], std::make_tuple(size_t(2), std::string("ef")));
+}
+
+TEST_F(IoTest, ReadNumbers) {
+  write("1 -2\t+3\n\n  40x 5\r\n99999999999 0x10 -\n7");
+  ftl::parse_status status;
+  EXPECT_EQ(ftl::read_numbers<int>(path, &status).get(),
+            std::vector<int>({1, -2, 3, 5, 7}));
+  EXPECT_EQ(status.parsed, 5);
+  EXPECT_EQ(status.malformed, 4);
+
+  write("1.5 -2e3\n.25 nan? 1e400 3");
+  status = ftl::parse_status();
+  EXPECT_EQ(ftl::read_numbers<double>(path, &status).get(),
+            std::vector<double>({1.5, -2000, 0.25, 3}));
+  EXPECT_EQ(status.malformed, 2);
+  EXPECT_EQ(ftl::read_numbers<double>(path).take(2).sum(), -1998.5);
+}
+
+TEST_F(IoTest, ReadNumbersStream) {
+  std::string contents;
+  int64_t sum = 0;
+  for (int64_t i = 0; i < 300000; ++i) {
+    contents += std::to_string(i * 7919) + (i % 3 == 0 ? "\n" : " ");
+    sum += i * 7919;
+  }
+  contents += "bad 12";
+  write(contents);
+
+  ftl::parse_status status;
+  std::istringstream s(contents);
+  EXPECT_EQ(ftl::read_numbers<int64_t>(s, &status).sum(), sum + 12);
+  EXPECT_EQ(status.parsed, 300001);
+  EXPECT_EQ(status.malformed, 1);
+  EXPECT_EQ(ftl::read_numbers<int64_t>(path).sum(), sum + 12);
+
+  std::istringstream empty("  \n ");
+  EXPECT_EQ(ftl::read_numbers<int>(empty).count(), 0);
+}
+
+struct point {
+  int32_t x;
+  double y;
+};
+
+TEST_F(IoTest, Records) {
+  const std::vector<int> a({3, 1, 2});
+  ftl::make_seq(a.begin(), a.end())
+      .map([](let x){ return point{x, 0.5 * x}; })
+      .write_records(path);
+
+  let res = ftl::read_records<point>(path);
+  EXPECT_EQ(res.count(), 3);
+  EXPECT_EQ(res.map([](let p){ return p.x; }).get(),
+            std::vector<int>({3, 1, 2}));
+  EXPECT_EQ(res.map([](let p){ return p.y; }).sum(), 3.0);
+}
+
+TEST_F(IoTest, RecordsRoundTrip) {
+  std::vector<int64_t> values;
+  for (int64_t i = 0; i < 500000; ++i) {
+    values.push_back(i * i - 7);
+  }
+  let s = ftl::make_seq(values.begin(), values.end());
+
+  s.write_records(path);
+  EXPECT_EQ(ftl::read_records<int64_t>(path).get(), values);
+  EXPECT_EQ(ftl::read_records<int64_t>(path).par(4).sum(), s.sum());
+
+  s.filter([](let x){ return x % 2 == 0; }).write_records(path);
+  EXPECT_EQ(ftl::read_records<int64_t>(path).get(),
+            s.filter([](let x){ return x % 2 == 0; }).get());
+
+  ftl::read_records<int64_t>(path).eval().drop(10).write_records(path + "2");
+  EXPECT_EQ(ftl::read_records<int64_t>(path + "2").count(), 249990);
+  std::remove((path + "2").c_str());
+
+  ftl::read_records<int64_t>(path)
+      .map([](let x){ return x + 1; })
+      .write_records(path);
+  EXPECT_EQ(ftl::read_records<int64_t>(path).get(),
+            s.filter([](let x){ return x % 2 == 0; })
+                .map([](let x){ return x + 1; })
+                .get());
+  ftl::read_records<int64_t>(path).eval().take(5).write_records(path);
+  EXPECT_EQ(ftl::read_records<int64_t>(path).count(), 5);
+
+  EXPECT_THROW(s.write_records(path + "_missing/records"),
+               std::runtime_error);
+
+  write("12345");
+  EXPECT_THROW(ftl::read_records<int32_t>(path), std::runtime_error);
+  EXPECT_EQ(ftl::read_records<char>(path).count(), 5);
+}
+
+TEST_F(IoTest, MmapBytes) {
+  write("a b  c\n");
+  EXPECT_EQ(ftl::mmap_bytes(path).count(), 7);
+  EXPECT_EQ(ftl::mmap_bytes(path).count([](let c){ return c == ' '; }), 3);
+  EXPECT_EQ(ftl::mmap_bytes(path).split_view(" \n").count(), 5);
+}
+
+TEST_F(IoTest, MmapResizeFailure) {
+  write("abc");
+  ftl::impl::mapped_file file(path);
+  EXPECT_THROW(file.resize(10), std::system_error);
+  ASSERT_EQ(file.size(), 3);
+  EXPECT_EQ(std::string(file.begin(), file.end()), "abc");
+}
+
+TEST_F(IoTest, MmapMissingFile) {
+  EXPECT_THROW(ftl::mmap_lines(path + "_missing"), std::system_error);
+}
@@ -1,3 +1,15 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
 #include <gtest/gtest.h>
 
 #include <ftl/ftl.h>
@@ -7,7 +19,7 @@ public:
   MemoizeIntTest() : a({1, 2, 3}), s(ftl::make_seq(a.begin(), a.end())) { }
 
   const std::vector<int> a;
-  ftl::seq<ftl::impl::seq_iter<std::vector<const int>::iterator>, int> s;
+  ftl::seq<ftl::impl::seq_iter<std::vector<int>::const_iterator>, int> s;
 };
 
 TEST_F(MemoizeIntTest, Basic) {
@@ -38,3 +50,411 @@ TEST_F(MemoizeIntTest, Adversarial) {
   EXPECT_EQ(is_even(2),   true);
 }
 
+
+TEST_F(MemoizeIntTest, Concurrent) {
+  std::vector<std::atomic<int>> calls(1000);
+  let square_impl = [&calls](let x){ ++calls[x]; return x * x; };
+  let square = ftl::concurrent_memoize<decltype(square_impl), int>(square_impl);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&square, t]() {
+        for (int i = 0; i < 1000; ++i) {
+          let x = (i * 7 + t * 131) % 1000;
+          EXPECT_EQ(square(x), x * x);
+        }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  for (const auto &num : calls) {
+    EXPECT_EQ(num, 1);
+  }
+}
+
+TEST_F(MemoizeIntTest, ConcurrentException) {
+  bool fail = true;
+  let is_even_impl = [&fail](let x){
+      if (fail) {
+        throw std::runtime_error("fail");
+      }
+      return x % 2 == 0;
+  };
+  let is_even = ftl::concurrent_memoize<decltype(is_even_impl), int>(
+      is_even_impl);
+
+  EXPECT_THROW(is_even(2), std::runtime_error);
+  fail = false;
+  EXPECT_EQ(is_even(2), true);
+  fail = true;
+  EXPECT_EQ(is_even(2), true);
+}
+
+TEST_F(MemoizeIntTest, Bounded) {
+  int calls = 0;
+  let square_impl = [&calls](let x){ ++calls; return x * x; };
+  let square = ftl::bounded_memoize<decltype(square_impl), int>(square_impl, 2);
+
+  EXPECT_EQ(square(1), 1);
+  EXPECT_EQ(square(2), 4);
+  EXPECT_EQ(square(1), 1);
+  EXPECT_EQ(calls, 2);
+
+  // 1 was referenced, so the hand clears its bit and evicts 2
+  EXPECT_EQ(square(3), 9);
+  EXPECT_EQ(square.size(), 2);
+  EXPECT_EQ(calls, 3);
+  EXPECT_EQ(square(1), 1);
+  EXPECT_EQ(calls, 3);
+  EXPECT_EQ(square(2), 4);
+  EXPECT_EQ(calls, 4);
+}
+
+TEST_F(MemoizeIntTest, BoundedCapacity) {
+  let square_impl = [](let x){ return x * x; };
+  using memoize_type = ftl::bounded_memoize<decltype(square_impl), int>;
+  let square = memoize_type(square_impl, memoize_type::capacity_for(1 << 16));
+
+  for (int i = 0; i < 100000; ++i) {
+    EXPECT_EQ(square(i % 5000), (i % 5000) * (i % 5000));
+  }
+  EXPECT_LE(square.size(), square.capacity());
+  EXPECT_GT(square.capacity(), 100);
+}
+
+TEST_F(MemoizeIntTest, BoundedStrings) {
+  int calls = 0;
+  let repeat_impl = [&calls](const std::string &s, let n) {
+      ++calls;
+      std::string res;
+      for (int i = 0; i < n; ++i) {
+        res += s;
+      }
+      return res;
+  };
+  let repeat = ftl::bounded_memoize<decltype(repeat_impl), std::string, int>(
+      repeat_impl, 64);
+
+  const std::string key = "a fairly long key that does not fit inline";
+  const std::string &first = repeat(key, 3);
+  EXPECT_EQ(first, key + key + key);
+  EXPECT_EQ(&repeat(key, 3), &first);
+  EXPECT_EQ(calls, 1);
+
+  // Churn through many more keys than fit, checking every value
+  uint64_t state = 1;
+  for (int i = 0; i < 20000; ++i) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    const int n = static_cast<int>((state >> 33) % 300);
+    const std::string s = "key" + std::to_string(n);
+    std::string expected;
+    for (int j = 0; j < n % 4; ++j) {
+      expected += s;
+    }
+    ASSERT_EQ(repeat(s, n % 4), expected);
+    const int before = calls;
+    ASSERT_EQ(repeat(s, n % 4), expected);
+    ASSERT_EQ(calls, before);
+    ASSERT_LE(repeat.size(), 64);
+  }
+  EXPECT_EQ(repeat.size(), 64);
+  EXPECT_LT(calls, 20000);
+}
+
+TEST_F(MemoizeIntTest, TupleHash) {
+  let hash = ftl::impl::tuple_hash<int, int>();
+  EXPECT_NE(hash(std::make_tuple(1, 2)), hash(std::make_tuple(2, 1)));
+  EXPECT_NE(hash(std::make_tuple(3, 3)), hash(std::make_tuple(4, 4)));
+}
+
+TEST_F(MemoizeIntTest, MultipleArgs) {
+  int calls = 0;
+  let pow_impl = [&calls](let x, let n){
+      ++calls;
+      int res = 1;
+      for (int i = 0; i < n; ++i) {
+        res *= x;
+      }
+      return res;
+  };
+  let pow = ftl::memoize<decltype(pow_impl), int, int>(pow_impl);
+
+  EXPECT_EQ(pow(2, 3), 8);
+  EXPECT_EQ(pow(3, 2), 9);
+  EXPECT_EQ(pow(2, 3), 8);
+  EXPECT_EQ(calls, 2);
+}
+
+TEST_F(MemoizeIntTest, Grow) {
+  int calls = 0;
+  let square_impl = [&calls](let x){ ++calls; return x * x; };
+  let square = ftl::memoize<decltype(square_impl), int>(square_impl);
+
+  const int &first = square(0);
+  for (int i = 0; i < 10000; ++i) {
+    EXPECT_EQ(square(i), i * i);
+  }
+  for (int i = 0; i < 10000; ++i) {
+    EXPECT_EQ(square(i), i * i);
+  }
+  EXPECT_EQ(calls, 10000);
+  EXPECT_EQ(first, 0);
+}
+
+TEST(MemoizeStringTest, Basic) {
+  let length_impl = [](const std::string &s, int n){ return s.size() * n; };
+  let length = ftl::memoize<decltype(length_impl), std::string, int>(
+      length_impl);
+
+  EXPECT_EQ(length("abc", 2), 6);
+  EXPECT_EQ(length("ab", 3), 6);
+  EXPECT_EQ(length("abc", 2), 6);
+}
+
+TEST_F(MemoizeIntTest, Dense) {
+  int calls = 0;
+  let is_even_impl = [&calls](let x){ ++calls; return x % 2 == 0; };
+  let is_even = ftl::dense_memoize<decltype(is_even_impl), int>(
+      is_even_impl, -10, 100);
+
+  EXPECT_EQ(is_even(-10), true);
+  EXPECT_EQ(is_even(1),   false);
+  EXPECT_EQ(is_even(99),  false);
+  EXPECT_EQ(is_even(1),   false);
+  EXPECT_EQ(calls, 3);
+  EXPECT_THROW(is_even(100), std::out_of_range);
+  EXPECT_THROW(is_even(-11), std::out_of_range);
+}
+
+TEST_F(MemoizeIntTest, DensePrefill) {
+  std::atomic<int> calls(0);
+  let square_impl = [&calls](let x){ ++calls; return x * x; };
+  auto square = ftl::dense_memoize<decltype(square_impl), int>(
+      square_impl, 0, 1000);
+
+  EXPECT_EQ(square(10), 100);
+  square.prefill();
+  EXPECT_EQ(calls, 1000);
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(square(i), i * i);
+  }
+  EXPECT_EQ(calls, 1000);
+}
+
+TEST_F(MemoizeIntTest, Copy) {
+  int calls = 0;
+  let square_impl = [&calls](let x){ ++calls; return x * x; };
+  using memoize_type = ftl::memoize<decltype(square_impl), int>;
+
+  auto original = std::make_unique<memoize_type>(square_impl);
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ((*original)(i), i * i);
+  }
+  const memoize_type copy(*original);
+  original.reset();
+
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(copy(i), i * i);
+  }
+  EXPECT_EQ(calls, 1000);
+  EXPECT_EQ(copy(1000), 1000000);
+  EXPECT_EQ(calls, 1001);
+
+  // Stages capture their function by value
+  EXPECT_EQ(s.filter(copy).count(), 3);
+  EXPECT_EQ(calls, 1001);
+}
+
+TEST_F(MemoizeIntTest, FlatTableAssign) {
+  using table_type = ftl::impl::flat_table<int, int>;
+  auto original = std::make_unique<table_type>();
+  for (int i = 0; i < 1000; ++i) {
+    original->insert(std::hash<int>()(i), int(i), i * 2);
+  }
+  table_type assigned;
+  assigned = *original;
+  original.reset();
+
+  for (int i = 0; i < 1000; ++i) {
+    const auto *e = assigned.find(std::hash<int>()(i),
+                                  [i](int key) { return key == i; });
+    ASSERT_NE(e, nullptr);
+    EXPECT_EQ(e->value, i * 2);
+  }
+  EXPECT_EQ(assigned.find(std::hash<int>()(1000),
+                          [](int key) { return key == 1000; }), nullptr);
+}
+
+TEST_F(MemoizeIntTest, RecursiveCopy) {
+  let fib_impl = [](const auto &self, int n) -> uint64_t {
+      return n < 2 ? n : self(n - 1) + self(n - 2);
+  };
+  auto original = std::make_unique<
+      ftl::memoize_rec<decltype(fib_impl), int>>(fib_impl);
+  EXPECT_EQ((*original)(50), 12586269025ull);
+  const auto copy = *original;
+  original.reset();
+  EXPECT_EQ(copy(50), 12586269025ull);
+  EXPECT_EQ(copy(60), 1548008755920ull);
+}
+
+TEST_F(MemoizeIntTest, Recursive) {
+  int calls = 0;
+  let fib = ftl::make_memoize_rec<int>(
+      [&calls](const auto &self, int n) -> uint64_t {
+          ++calls;
+          return n < 2 ? n : self(n - 1) + self(n - 2);
+      });
+
+  EXPECT_EQ(fib(90), 2880067194370816120ull);
+  EXPECT_EQ(calls, 91);
+  EXPECT_EQ(fib(50), 12586269025ull);
+  EXPECT_EQ(calls, 91);
+}
+
+TEST_F(MemoizeIntTest, Persistent) {
+  const std::string path = ::testing::TempDir() + "ftl_persistent_memoize";
+  std::remove(path.c_str());
+
+  int calls = 0;
+  let add_impl = [&calls](let x, let y){ ++calls; return 0.5 * x + y; };
+  using memoize_type = ftl::persistent_memoize<decltype(add_impl), int, int>;
+  {
+    let add = memoize_type(add_impl, path, 4);
+    for (int i = 0; i < 1000; ++i) {
+      EXPECT_EQ(add(i, 1), 0.5 * i + 1);
+    }
+    EXPECT_EQ(add(3, 1), 2.5);
+    EXPECT_EQ(calls, 1000);
+    EXPECT_EQ(add.size(), 1000);
+    add.flush();
+    EXPECT_FALSE(std::ifstream(path + ".tmp").good());
+  }
+  {
+    let add = memoize_type(add_impl, path);
+    EXPECT_EQ(add.size(), 1000);
+    for (int i = 0; i < 1000; ++i) {
+      EXPECT_EQ(add(i, 1), 0.5 * i + 1);
+    }
+    EXPECT_EQ(add(1, 3), 3.5);
+    EXPECT_EQ(calls, 1001);
+  }
+  std::remove(path.c_str());
+}
+
+TEST_F(MemoizeIntTest, PersistentCopyAfterGrow) {
+  const std::string path = ::testing::TempDir() + "ftl_persistent_copy";
+  std::remove(path.c_str());
+
+  int calls = 0;
+  let square_impl = [&calls](let x){ ++calls; return x * x; };
+  using memoize_type = ftl::persistent_memoize<decltype(square_impl), int>;
+  const memoize_type square(square_impl, path, 4);
+  const memoize_type copy(square);
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(square(i), i * i);
+  }
+  EXPECT_EQ(copy.size(), 100);
+  EXPECT_EQ(copy(99), 9801);
+  EXPECT_EQ(calls, 100);
+  std::remove(path.c_str());
+}
+
+TEST_F(MemoizeIntTest, PersistentForeignFile) {
+  const std::string path = ::testing::TempDir() + "ftl_persistent_foreign";
+  const std::string contents = "precious user data, not a cache\n";
+  std::ofstream(path, std::ios::binary | std::ios::trunc) << contents;
+
+  let square_impl = [](let x){ return x * x; };
+  using memoize_type = ftl::persistent_memoize<decltype(square_impl), int>;
+  EXPECT_THROW(memoize_type(square_impl, path), std::runtime_error);
+
+  std::ifstream f(path, std::ios::binary);
+  const std::string res((std::istreambuf_iterator<char>(f)),
+                        std::istreambuf_iterator<char>());
+  EXPECT_EQ(res, contents);
+  EXPECT_FALSE(std::ifstream(path + ".tmp").good());
+  std::remove(path.c_str());
+}
+
+TEST_F(MemoizeIntTest, PersistentLayoutMismatch) {
+  const std::string path = ::testing::TempDir() + "ftl_persistent_mismatch";
+  std::remove(path.c_str());
+
+  let square_impl = [](let x){ return x * x; };
+  {
+    let square = ftl::persistent_memoize<decltype(square_impl), int>(
+        square_impl, path);
+    EXPECT_EQ(square(3), 9);
+  }
+  {
+    let square = ftl::persistent_memoize<decltype(square_impl), int64_t>(
+        square_impl, path);
+    EXPECT_EQ(square.size(), 0);
+    EXPECT_EQ(square(3), 9);
+  }
+  std::remove(path.c_str());
+}
+
+TEST(MemoizeStatsTest, HitsAndMisses) {
+  let square_impl = [](let x){ return x * x; };
+  let square = ftl::memoize_with_stats<decltype(square_impl), int>(
+      square_impl);
+
+  for (int i = 0; i < 10; ++i) {
+    square(i);
+    square(i);
+    square(i);
+  }
+  let stats = square.stats();
+  EXPECT_EQ(stats.hits, 20);
+  EXPECT_EQ(stats.misses, 10);
+  EXPECT_EQ(stats.insertions, 10);
+  EXPECT_EQ(stats.evictions, 0);
+  EXPECT_EQ(stats.entries, 10);
+  EXPECT_GE(stats.bytes, 10 * (sizeof(int) + sizeof(int)));
+}
+
+TEST(MemoizeStatsTest, ComputeTime) {
+  let slow_impl = [](let x){
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return x;
+  };
+  let slow = ftl::memoize_with_stats<decltype(slow_impl), int>(slow_impl);
+
+  slow(1);
+  slow(2);
+  slow(1);
+  EXPECT_GE(slow.stats().compute_time, std::chrono::milliseconds(2));
+}
+
+TEST(MemoizeStatsTest, Evictions) {
+  let square_impl = [](let x){ return x * x; };
+  let square = ftl::bounded_memoize_with_stats<decltype(square_impl), int>(
+      square_impl, 4);
+
+  for (int i = 0; i < 10; ++i) {
+    square(i);
+  }
+  square(9);
+  let stats = square.stats();
+  EXPECT_EQ(stats.hits, 1);
+  EXPECT_EQ(stats.misses, 10);
+  EXPECT_EQ(stats.insertions, 10);
+  EXPECT_EQ(stats.evictions, 6);
+  EXPECT_EQ(stats.entries, 4);
+}
+
+TEST(MemoizeStatsTest, NoStatsLayout) {
+  let square_impl = [](let x){ return x * x; };
+  using plain_type = ftl::memoize<decltype(square_impl), int>;
+  using counting_type = ftl::memoize_with_stats<decltype(square_impl), int>;
+  struct members {
+    ftl::impl::flat_table<std::tuple<int>, int> cache;
+    decltype(square_impl) f;
+  };
+  EXPECT_EQ(sizeof(plain_type), sizeof(members));
+  EXPECT_GT(sizeof(counting_type), sizeof(plain_type));
+}
@@ -1,3 +1,12 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <list>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -246,6 +255,129 @@ TEST_F(SeqIntTest, Reject) {
   EXPECT_EQ(it, res.end());
 }
 
+TEST_F(SeqIntTest, RandomAccessShortcuts) {
+  using seq_type = std::decay<decltype(s)>::type;
+  EXPECT_TRUE((std::is_same<decltype(s.drop(1)), seq_type>::value));
+  EXPECT_TRUE((std::is_same<decltype(s.take(1)), seq_type>::value));
+
+  EXPECT_EQ(s.drop(5).count(), 0);
+  EXPECT_EQ(s.take(5).get(), a);
+  EXPECT_EQ(s.drop(1).take(1).get(), std::vector<int>({2}));
+  EXPECT_EQ(*s.drop(1).tail(), 3);
+  EXPECT_FALSE(s.drop(3).tail());
+  EXPECT_EQ(s.reverse().drop(1).get(), std::vector<int>({2, 1}));
+  EXPECT_EQ(s.reverse().reverse().get(), a);
+
+  let reversed = s.map([](let x){ return x * 10; }).eval().reverse();
+  EXPECT_EQ(reversed.get(), std::vector<int>({30, 20, 10}));
+}
+
+TEST(SeqDropEveryTest, MatchesSequential) {
+  std::vector<int> v;
+  for (int i = 0; i < 50; ++i) {
+    v.push_back(i);
+  }
+  const std::list<int> l(v.begin(), v.end());
+  let s = ftl::make_seq(v.begin(), v.end());
+  let t = ftl::make_seq(l.begin(), l.end());
+
+  for (size_t num = 1; num < 8; ++num) {
+    EXPECT_EQ(s.drop_every(num).get(), t.drop_every(num).get());
+    EXPECT_EQ(s.drop_every(num).count(), t.drop_every(num).count());
+    EXPECT_EQ(s.drop_every(num).take_while([](let x){ return x < 20; }).get(),
+              t.drop_every(num).take_while([](let x){ return x < 20; }).get());
+  }
+}
+
+TEST_F(SeqIntTest, SizeHintExact) {
+  let res = s.map([](let x){ return x * x; }).with_index().get();
+  EXPECT_EQ(res.size(), 3);
+  EXPECT_EQ(res.capacity(), 3);
+
+  let dropped = s.drop(1).get();
+  EXPECT_EQ(dropped.size(), 2);
+  EXPECT_EQ(dropped.capacity(), 2);
+}
+
+TEST_F(SeqIntTest, SizeHintUpperBound) {
+  let filtered = s.filter([](let x){ return x > 1; }).get();
+  EXPECT_EQ(filtered.size(), 2);
+  EXPECT_EQ(filtered.capacity(), 3);
+
+  let taken = s.map([](let x){ return x + 1; }).take(2).get();
+  EXPECT_EQ(taken.size(), 2);
+  EXPECT_EQ(taken.capacity(), 2);
+
+  const std::vector<int> large(1 << 20);
+  let none = ftl::make_seq(large.begin(), large.end())
+      .filter([](let x){ return x > 0; })
+      .get();
+  EXPECT_TRUE(none.empty());
+  EXPECT_EQ(none.capacity(),
+            ftl::impl::max_bound_reserve_bytes / sizeof(int));
+}
+
+TEST(SeqSizeHintTest, TakeFromUnknown) {
+  let res = ftl::iota(0)
+      .take(std::numeric_limits<size_t>::max())
+      .take_while([](let x){ return x < 3; })
+      .get();
+  EXPECT_EQ(res, std::vector<int>({0, 1, 2}));
+  EXPECT_LT(res.capacity(), 1000);
+}
+
+struct copy_counter {
+  copy_counter() { }
+  copy_counter(const copy_counter&) { ++copies; }
+  copy_counter(copy_counter&&) noexcept { }
+  copy_counter& operator=(const copy_counter&) { ++copies; return *this; }
+  copy_counter& operator=(copy_counter&&) noexcept { return *this; }
+
+  static int copies;
+};
+
+int copy_counter::copies = 0;
+
+TEST_F(SeqIntTest, MovesProducedValues) {
+  copy_counter::copies = 0;
+  let values = s.map([](let){ return copy_counter(); });
+
+  let res = values.filter([](let &){ return true; })
+      .drop_while([](let &){ return false; })
+      .get();
+  EXPECT_EQ(res.size(), 3);
+  values.head();
+  values.tail();
+  values.with_index().get();
+  EXPECT_EQ(copy_counter::copies, 0);
+}
+
+TEST_F(SeqIntTest, ApplyDoesNotCopyStages) {
+  const copy_counter state;
+  let res = s.map([state](let x){ return x + 1; })
+      .filter([state](let x){ return x > 0; });
+
+  copy_counter::copies = 0;
+  EXPECT_EQ(res.get().size(), 3);
+  EXPECT_EQ(res.sum(), 9);
+  EXPECT_EQ(res.count(), 3);
+  EXPECT_TRUE(res.any());
+  EXPECT_EQ(copy_counter::copies, 0);
+}
+
+TEST_F(SeqIntTest, CopiesUnderlyingData) {
+  let res = s.get();
+  EXPECT_EQ(res, a);
+  EXPECT_EQ(s.get(), a);
+}
+
+TEST(SeqSizeHintTest, Unknown) {
+  const std::list<int> a({1, 2, 3});
+  let res = ftl::make_seq(a.begin(), a.end()).map([](let x){ return x; })
+      .get();
+  EXPECT_EQ(res, std::vector<int>({1, 2, 3}));
+}
+
 //----------------------------------------------------------------------------//
 
 class SeqIntRepeatTest : public ::testing::Test {
@@ -643,3 +775,393 @@ TEST_F(StringTest, SplitToStringOnComma) {
   EXPECT_EQ(it, split.end());
 }
 
+TEST_F(StringTest, SplitViewOnWhitespace) {
+  let split = s.split_view(' ').get();
+  let expected = s.split<std::string>(' ').get();
+
+  ASSERT_EQ(split.size(), expected.size());
+  for (size_t i = 0; i < split.size(); ++i) {
+    EXPECT_EQ(split[i], expected[i]);
+    EXPECT_GE(split[i].data(), a.data());
+    EXPECT_LE(split[i].data() + split[i].size(), a.data() + a.size());
+  }
+}
+
+TEST_F(StringTest, SplitViewEmptyTokens) {
+  const std::string b(",a,,b,");
+  let split = ftl::make_seq(b.begin(), b.end()).split_view(',').get();
+  let expected = std::vector<std::string_view>({"", "a", "", "b", ""});
+  EXPECT_EQ(split, expected);
+
+  const std::string c;
+  EXPECT_EQ(ftl::make_seq(c.begin(), c.end()).split_view(',').count(), 0);
+}
+
+TEST_F(StringTest, SplitViewAnyOf) {
+  const std::string b("one two,three\nfour");
+  let split = ftl::make_seq(b.begin(), b.end()).split_view(" ,\n").get();
+  let expected = std::vector<std::string_view>({"one", "two", "three", "four"});
+  EXPECT_EQ(split, expected);
+}
+
+TEST_F(StringTest, SplitThroughput) {
+  std::string text;
+  while (text.size() < (16 << 20)) {
+    text += a;
+    text += '\n';
+  }
+  let chars = ftl::make_seq(text.begin(), text.end());
+  let mb = static_cast<double>(text.size()) / (1 << 20);
+
+  const auto time = [mb](const char *name, const auto &f) {
+      const auto start = std::chrono::steady_clock::now();
+      const size_t res = f();
+      const std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      std::cout << "  " << name << ": " << mb / elapsed.count() << " MB/s"
+                << std::endl;
+      return res;
+  };
+
+  let lines = time("split lines (element-wise)", [&chars]() {
+      return chars.map([](let c){ return c; }).split('\n').count();
+  });
+  EXPECT_EQ(time("split lines", [&chars]() {
+      return chars.split('\n').count();
+  }), lines);
+  EXPECT_EQ(time("split_view lines", [&chars]() {
+      return chars.split_view('\n').count();
+  }), lines);
+
+  let tokens = time("split_view words", [&chars]() {
+      return chars.split_view(' ').count();
+  });
+  EXPECT_GT(time("split_view any of", [&chars]() {
+      return chars.split_view(" \n").count();
+  }), tokens);
+}
+
+TEST_F(StringTest, SplitViewKeepsDataAlive) {
+  auto tokens = s.split_view(' ').take(0).eval();
+  {
+    let chars = ftl::make_seq(a.begin(), a.end()).eval();
+    tokens = chars.split_view(' ').eval();
+  }
+  EXPECT_EQ(*tokens.head(), "the");
+  EXPECT_EQ(*tokens.tail(), "dog");
+}
+
+
+//------------------------------------------------------------------------------
+
+class SeqParTest : public ::testing::Test {
+public:
+  SeqParTest() : a(make_vector(10000)), s(ftl::make_seq(a.begin(), a.end())) { }
+
+  static std::vector<int> make_vector(int n) {
+    std::vector<int> res;
+    for (int i = 1; i <= n; ++i) {
+      res.push_back(i);
+    }
+    return res;
+  }
+
+  const std::vector<int> a;
+  ftl::seq<ftl::impl::seq_iter<std::vector<int>::const_iterator>, int> s;
+};
+
+TEST_F(SeqParTest, Sum) {
+  let res = s.par(4).sum<int64_t>();
+  EXPECT_EQ(res, 50005000);
+}
+
+TEST_F(SeqParTest, MapFilterSum) {
+  let res = s.map([](let x){ return x * 2; })
+      .filter([](let x){ return x % 3 == 0; })
+      .par(4)
+      .sum<int64_t>();
+  let expected = s.map([](let x){ return x * 2; })
+      .filter([](let x){ return x % 3 == 0; })
+      .sum<int64_t>();
+  EXPECT_EQ(res, expected);
+}
+
+TEST_F(SeqParTest, Reduce) {
+  let res = s.par(3).reduce(std::string(),
+      [](let acc, let x){ return x % 1000 == 0 ? acc + "x" : acc; },
+      [](let acc, let x){ return acc + x; });
+  EXPECT_EQ(res, "xxxxxxxxxx");
+}
+
+TEST_F(SeqParTest, Count) {
+  EXPECT_EQ(s.par(4).count(), 10000);
+  EXPECT_EQ(s.par(4).count([](let x){ return x % 2 == 0; }), 5000);
+}
+
+TEST_F(SeqParTest, AnyAll) {
+  EXPECT_EQ(s.par(4).any([](let x){ return x == 7777; }), true);
+  EXPECT_EQ(s.par(4).any([](let x){ return x > 10000; }), false);
+  EXPECT_EQ(s.par(4).all([](let x){ return x > 0; }), true);
+  EXPECT_EQ(s.par(4).all([](let x){ return x < 9999; }), false);
+}
+
+TEST_F(SeqParTest, Max) {
+  EXPECT_EQ(*s.par(4).max(), 10000);
+  EXPECT_EQ(*s.par(4).max([](let x, let y){ return x > y; }), 1);
+}
+
+TEST_F(SeqParTest, FlatMap) {
+  let res = s.take_while([](let x){ return x <= 100; })
+      .eval()
+      .map([this](let x){ return s.take_while([x](let y){ return y <= x; }); })
+      .flat_map([](let x){ return x; })
+      .par(4)
+      .sum<int64_t>();
+  EXPECT_EQ(res, 171700);
+}
+
+TEST_F(SeqParTest, Batched) {
+  let is_odd = [](let x){ return x % 2 == 1; };
+  let square = [](let x){ return static_cast<int64_t>(x) * x; };
+
+  int64_t sum = 0;
+  size_t count = 0;
+  for (let x : a) {
+    if (is_odd(x)) {
+      sum += square(x);
+      ++count;
+    }
+  }
+
+  EXPECT_EQ(s.filter(is_odd).map(square).sum(), sum);
+  EXPECT_EQ(s.map(square).filter(is_odd).sum(), sum);
+  EXPECT_EQ(s.filter(is_odd).count(), count);
+  EXPECT_EQ(s.filter(is_odd).count(is_odd), count);
+  EXPECT_EQ(s.map(square).reduce(int64_t(0), [](let acc, let x){
+      return acc + x;
+  }), s.map(square).par(4).sum());
+  EXPECT_EQ(s.drop(1).filter(is_odd).count(), count - 1);
+}
+
+TEST_F(SeqParTest, Kernels) {
+  let doubles = s.map([](let x){ return 1.0 / x; }).eval();
+  long double exact = 0.0;
+  for (let x : a) {
+    exact += 1.0 / x;
+  }
+  let expected = static_cast<double>(exact);
+
+  EXPECT_EQ(s.sum(), 50005000);
+  EXPECT_EQ(s.sum<int64_t>(1), 50005001);
+  EXPECT_EQ(s.reduce(0, std::plus<int>()), 50005000);
+  EXPECT_EQ(s.reduce(int64_t(0), std::plus<>()), 50005000);
+  EXPECT_EQ(s.drop(1).reduce(0, std::plus<>()), 50004999);
+
+  // Mixed types must fold in the common type, not cast each element to T
+  std::vector<double> halves(63, -0.5);
+  halves.insert(halves.begin(), 2.0);
+  let mixed = ftl::make_seq(halves.begin(), halves.end());
+  EXPECT_EQ(mixed.reduce(0, std::plus<>()),
+            mixed.reduce(0, [](let acc, let x){ return acc + x; }));
+  EXPECT_EQ(mixed.reduce(0, std::plus<>()), 0);
+  EXPECT_EQ(mixed.reduce(0, std::plus<int>()), 2);
+  EXPECT_NEAR(doubles.sum(), expected, 1e-12);
+  EXPECT_NEAR(doubles.par(4).sum(), expected, 1e-12);
+  EXPECT_DOUBLE_EQ(doubles.kahan_sum(), expected);
+  EXPECT_EQ(doubles.kahan_sum(), doubles.drop(0).kahan_sum());
+  EXPECT_EQ(*doubles.max(), 1.0);
+  EXPECT_EQ(*s.max(), 10000);
+  EXPECT_EQ(*s.par(4).max(), 10000);
+  EXPECT_FALSE(s.take_while([](let x){ return x < 0; }).eval().max());
+}
+
+TEST_F(SeqParTest, NotSplittable) {
+  let res = s.with_index()
+      .map([](let x){ return static_cast<int64_t>(std::get<0>(x)); })
+      .par(4)
+      .sum();
+  EXPECT_EQ(res, 49995000);
+}
+
+TEST_F(SeqParTest, Get) {
+  let res = s.filter([](let x){ return x % 7 == 0; }).par(4).get();
+  let expected = s.filter([](let x){ return x % 7 == 0; }).get();
+  EXPECT_EQ(res, expected);
+}
+
+TEST_F(SeqParTest, Sorted) {
+  let shuffled = s.map([](let x){ return (x * 7919) % 10007; }).eval();
+  let res = shuffled.par(4).sorted().get();
+  let expected = shuffled.sorted().get();
+  EXPECT_EQ(res, expected);
+
+  let repeated = s.map([](let x){ return (x * 7919) % 13; }).eval();
+  for (size_t n_threads : {2, 3, 5, 8, 17}) {
+    EXPECT_EQ(shuffled.par(n_threads).sorted().get(), expected);
+    EXPECT_EQ(repeated.par(n_threads).sorted().get(),
+              repeated.sorted().get());
+  }
+}
+
+TEST_F(SeqParTest, SortedStrings) {
+  let words = s.take(2000)
+      .map([](let x){ return std::to_string((x * 7919) % 2003) + "_word"; })
+      .eval();
+  let expected = words.sorted().get();
+  for (size_t n_threads : {2, 3, 4, 8}) {
+    EXPECT_EQ(words.par(n_threads).sorted().get(), expected);
+    EXPECT_EQ(words.par(n_threads)
+                  .sorted([](let x, let y){ return x < y; })
+                  .get(),
+              expected);
+  }
+}
+
+struct no_default {
+  explicit no_default(int val) : val(val) { }
+  int val;
+};
+
+TEST_F(SeqParTest, SortedNoDefault) {
+  let res = s.map([](let x){ return no_default((x * 7919) % 10007); })
+      .par(5)
+      .sorted([](let x, let y){ return x.val < y.val; })
+      .map([](let x){ return x.val; })
+      .get();
+  EXPECT_EQ(res,
+            s.map([](let x){ return (x * 7919) % 10007; }).sorted().get());
+}
+
+TEST_F(SeqParTest, SortedReverse) {
+  let res = s.par(3).sorted([](let x, let y){ return x > y; }).get();
+  let expected = s.reverse().get();
+  EXPECT_EQ(res, expected);
+}
+
+TEST_F(SeqNoOpsTest, ParSorted) {
+  let s = ftl::make_seq(a.begin(), a.end());
+  let res = s.par(2).sorted([](auto x, auto y){ return x.val > y.val; }).get();
+
+  auto it = res.begin();
+  EXPECT_EQ(it->val, 3);
+  ++it;
+  EXPECT_EQ(it->val, 2);
+  ++it;
+  EXPECT_EQ(it->val, 1);
+  ++it;
+  EXPECT_EQ(it, res.end());
+}
+
+TEST_F(SeqParTest, ParMap) {
+  let res = s.par_map([](let x){ return std::to_string(x); }, 4, 8).get();
+  let expected = s.map([](let x){ return std::to_string(x); }).get();
+  EXPECT_EQ(res, expected);
+}
+
+TEST_F(SeqParTest, ParMapTakeWhile) {
+  std::atomic<int> calls(0);
+  let res = s.par_map([&calls](let x){ ++calls; return x * x; }, 4, 16)
+      .take_while([](let x){ return x < 400; })
+      .get();
+
+  EXPECT_EQ(res.size(), 19);
+  EXPECT_EQ(res.back(), 361);
+  EXPECT_LE(calls, 20 + 16);
+}
+
+TEST_F(SeqParTest, ParMapException) {
+  let throwing = s.par_map([](let x){
+      if (x == 100) {
+        throw std::runtime_error("100");
+      }
+      return x;
+  }, 2);
+  EXPECT_THROW(throwing.sum(), std::runtime_error);
+}
+
+TEST_F(SeqParTest, AsyncBuffer) {
+  let res = s.map([](let x){ return std::to_string(x); })
+      .async_buffer(16)
+      .map([](let x){ return std::stoi(x); })
+      .get();
+  EXPECT_EQ(res, a);
+}
+
+TEST_F(SeqParTest, AsyncBufferStop) {
+  std::atomic<int> produced(0);
+  let res = s.map([&produced](let x){ ++produced; return x; })
+      .async_buffer(8)
+      .take(10)
+      .sum();
+  EXPECT_EQ(res, 55);
+  EXPECT_LE(produced, 10 + 8 + 1);
+}
+
+/* \brief Polls pred until it holds, giving up after a generous deadline so
+ *  that a broken implementation fails instead of hanging
+ */
+template <typename Pred>
+bool eventually(const Pred &pred) {
+  const auto deadline = std::chrono::steady_clock::now() +
+      std::chrono::seconds(20);
+  while (!pred()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+TEST(SpscQueueTest, SleepsWhenEmpty) {
+  ftl::impl::spsc_queue<int> queue(4);
+  int sum = 0;
+  std::thread consumer([&queue, &sum]() {
+      ftl::optional<int> x;
+      while (queue.pop(x)) {
+        sum += *x;
+      }
+  });
+
+  EXPECT_TRUE(eventually([&queue]() { return queue.consumer_sleeps(); }));
+  EXPECT_TRUE(queue.push(1));
+  EXPECT_TRUE(eventually([&queue]() { return queue.consumer_sleeps(); }));
+  EXPECT_TRUE(queue.push(2));
+  queue.close();
+  consumer.join();
+  EXPECT_EQ(sum, 3);
+}
+
+TEST(SpscQueueTest, SleepsWhenFull) {
+  ftl::impl::spsc_queue<int> queue(2);
+  bool pushed = false;
+  std::thread producer([&queue, &pushed]() {
+      queue.push(1);
+      queue.push(2);
+      pushed = queue.push(3);
+  });
+
+  EXPECT_TRUE(eventually([&queue]() { return queue.producer_sleeps(); }));
+  ftl::optional<int> x;
+  EXPECT_TRUE(queue.pop(x));
+  EXPECT_EQ(*x, 1);
+  producer.join();
+  EXPECT_TRUE(pushed);
+
+  // cancel() wakes a producer that sleeps on a full ring
+  std::thread stopped([&queue, &pushed]() { pushed = queue.push(4); });
+  EXPECT_TRUE(eventually([&queue]() { return queue.producer_sleeps(); }));
+  queue.cancel();
+  stopped.join();
+  EXPECT_FALSE(pushed);
+}
+
+TEST_F(SeqParTest, AsyncBufferException) {
+  let throwing = s.map([](let x){
+      if (x == 100) {
+        throw std::runtime_error("100");
+      }
+      return x;
+  });
+  EXPECT_THROW(throwing.async_buffer(4).sum(), std::runtime_error);
+}
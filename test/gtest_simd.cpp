@@ -0,0 +1,134 @@
+#include <cmath>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <ftl/ftl.h>
+
+class SimdTest : public ::testing::Test {
+public:
+  SimdTest() : text(make_text(1000)), separators(" ,\n", 3) { }
+
+  static std::string make_text(size_t n) {
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> dist(0, 9);
+    const char alphabet[] = "ab c,d\nefg";
+    std::string res;
+    for (size_t i = 0; i < n; ++i) {
+      res.push_back(alphabet[dist(gen)]);
+    }
+    return res;
+  }
+
+  std::vector<size_t> positions(size_t begin, size_t end) const {
+    std::vector<size_t> res;
+    ftl::impl::for_each_of(text.data() + begin, text.data() + end, separators,
+        [this, &res](const char *pos) {
+            res.push_back(static_cast<size_t>(pos - text.data()));
+            return true;
+        });
+    return res;
+  }
+
+  std::vector<size_t> expected(size_t begin, size_t end) const {
+    std::vector<size_t> res;
+    for (size_t i = begin; i < end; ++i) {
+      if (text[i] == ' ' || text[i] == ',' || text[i] == '\n') {
+        res.push_back(i);
+      }
+    }
+    return res;
+  }
+
+  const std::string text;
+  const ftl::impl::byte_set separators;
+};
+
+TEST_F(SimdTest, ForEachOf) {
+  for (size_t begin = 0; begin < 40; ++begin) {
+    for (size_t end = begin; end < 200; end += 7) {
+      EXPECT_EQ(positions(begin, end), expected(begin, end));
+    }
+  }
+  EXPECT_EQ(positions(0, text.size()), expected(0, text.size()));
+}
+
+TEST_F(SimdTest, ForEachOfStop) {
+  size_t num = 0;
+  const bool res = ftl::impl::for_each_of(text.data(),
+      text.data() + text.size(), separators,
+      [&num](const char*) { return ++num < 5; });
+  EXPECT_FALSE(res);
+  EXPECT_EQ(num, 5);
+}
+
+TEST_F(SimdTest, FindAny) {
+  const std::string s(100, 'x');
+  const char *begin = s.data();
+  const char *end = s.data() + s.size();
+  EXPECT_EQ(ftl::impl::find_any(begin, end, separators), end);
+  EXPECT_EQ(ftl::impl::find_any(text.data(), text.data() + text.size(),
+                                separators) - text.data(),
+            expected(0, text.size()).front());
+}
+
+TEST_F(SimdTest, ByteSetSize) {
+  EXPECT_THROW(ftl::impl::byte_set("", 0), std::invalid_argument);
+  EXPECT_THROW(ftl::impl::byte_set("abcdefghi", 9), std::invalid_argument);
+}
+
+TEST(SimdKernelTest, SumOf) {
+  std::vector<int8_t> bytes;
+  std::vector<int> ints;
+  for (int i = 0; i < 300; ++i) {
+    bytes.push_back(static_cast<int8_t>(i % 100));
+    ints.push_back(i * 1000003);
+  }
+  for (size_t n = 0; n <= bytes.size(); n += 13) {
+    int64_t bytes_sum = 0;
+    int64_t ints_sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+      bytes_sum += bytes[i];
+      ints_sum += ints[i];
+    }
+    EXPECT_EQ(ftl::impl::sum_of<int>(bytes.data(), n), bytes_sum);
+    EXPECT_EQ(ftl::impl::sum_of<int64_t>(ints.data(), n), ints_sum);
+    EXPECT_EQ(ftl::impl::sum_of<double>(ints.data(), n),
+              static_cast<double>(ints_sum));
+  }
+}
+
+TEST(SimdKernelTest, KahanSumOf) {
+  std::vector<double> values(1, 1e16);
+  for (int i = 0; i < 10000; ++i) {
+    values.push_back(1.0);
+  }
+  EXPECT_EQ(ftl::impl::kahan_sum_of<double>(values.data(), values.size()),
+            1e16 + 10000);
+  EXPECT_EQ(ftl::impl::kahan_sum_of<double>(values.data(), 0), 0.0);
+}
+
+TEST(SimdKernelTest, MaxOf) {
+  std::vector<int16_t> ints;
+  std::vector<double> doubles;
+  for (int i = 0; i < 300; ++i) {
+    ints.push_back(static_cast<int16_t>((i * 7919) % 1009 - 500));
+    doubles.push_back(std::sin(i));
+  }
+  for (size_t n = 1; n <= ints.size(); n += 11) {
+    EXPECT_EQ(ftl::impl::max_of(ints.data(), n),
+              *std::max_element(ints.begin(), ints.begin() + n));
+    EXPECT_EQ(ftl::impl::max_of(doubles.data(), n),
+              *std::max_element(doubles.begin(), doubles.begin() + n));
+  }
+
+  doubles[100] = std::numeric_limits<double>::quiet_NaN();
+  EXPECT_EQ(ftl::impl::max_of(doubles.data(), doubles.size()),
+            *std::max_element(doubles.begin(), doubles.end()));
+  doubles[0] = std::numeric_limits<double>::quiet_NaN();
+  EXPECT_TRUE(std::isnan(ftl::impl::max_of(doubles.data(), doubles.size())));
+}